@@ -4,85 +4,111 @@
 #include <Hir.hh>
 
 #include <coel/ir/Types.hh>
-#include <coel/support/Stack.hh>
 #include <fmt/format.h>
 
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace {
 
-enum class ConstraintKind {
-    Equals,
-    ImplicitlyCastable,
-    IntegerWidth,
+// A constraint that the value of one expression is implicitly castable to the type of another. Implicit casts are
+// currently only allowed between equal types, so each edge is a unification of the two expressions' types.
+struct CastEdge {
+    hir::ExprId from;
+    hir::ExprId to;
 };
 
-class Constraint {
-    union {
-        struct {
-            const hir::Type *type{nullptr};
-        } m_equals;
-        struct {
-            hir::ExprId expr{0};
-        } m_implicitly_castable;
-        struct {
-            std::size_t bit_width{0};
-        } m_integer_width;
-    };
-    ConstraintKind m_kind;
-
-public:
-    Constraint(const hir::Type &type) : m_kind(ConstraintKind::Equals), m_equals{&type} {}
-    Constraint(ConstraintKind kind, std::size_t bit_width) : m_kind(kind), m_integer_width{bit_width} {}
-
-    ConstraintKind kind() const { return m_kind; }
-    const hir::Type &equals_type() const { return *m_equals.type; }
-    hir::ExprId implicitly_castable_expr() const { return m_implicitly_castable.expr; }
-    std::size_t integer_width_bit_width() const { return m_integer_width.bit_width; }
+// A constraint that an integer literal needs at least bit_width bits to be represented.
+struct WidthConstraint {
+    hir::ExprId expr;
+    std::size_t bit_width;
 };
 
 class Constrainer final : public hir::Visitor {
     hir::Root &m_root;
     const hir::Function *m_function{nullptr};
-    std::vector<coel::Stack<Constraint>> m_constraints;
+    std::vector<CastEdge> m_edges;
+    std::vector<WidthConstraint> m_widths;
+    std::vector<hir::ExprId> m_worklist;
+    std::vector<hir::ExprId> m_matches;
 
     void analyse_binary(hir::ExprId id, hir::ExprId lhs_id, hir::ExprId rhs_id);
-    void analyse_block(const coel::List<hir::Stmt> &stmts);
-    void analyse_call(hir::ExprId id, const hir::Function *callee, const hir::ExprId *arg_ids);
+    void analyse_block(hir::ExprId id, std::span<const hir::Stmt> stmts, std::optional<hir::ExprId> value);
+    void analyse_call(const hir::Function *callee, std::span<const hir::ExprId> arg_ids);
     void analyse_constant(hir::ExprId id, std::size_t value);
-    void analyse_match(hir::ExprId id, hir::ExprId matchee_id, const std::pair<hir::ExprId, hir::ExprId> *arms,
-                       std::size_t arm_count);
+    void analyse_match(hir::ExprId id, hir::ExprId matchee_id,
+                       std::span<const std::pair<hir::ExprId, hir::ExprId>> arms);
     void analyse_var(hir::ExprId id);
     void analyse_expr(hir::ExprId id);
 
 public:
-    explicit Constrainer(hir::Root &root) : m_root(root) { m_constraints.resize(root.expr_count()); }
+    explicit Constrainer(hir::Root &root) : m_root(root) {}
 
     void visit(const hir::DeclStmt &decl_stmt) override;
     void visit(const hir::Function &function) override;
     void visit(const hir::ReturnStmt &return_stmt) override;
 
-    std::vector<coel::Stack<Constraint>> &constraints() { return m_constraints; }
+    void clear();
+
+    const std::vector<CastEdge> &edges() const { return m_edges; }
+    const std::vector<WidthConstraint> &widths() const { return m_widths; }
+    const std::vector<hir::ExprId> &matches() const { return m_matches; }
+};
+
+std::mutex s_type_mutex;
+
+// A type variable in the union-find forest. Only the fields of a representative (root) variable are meaningful.
+struct TypeVar {
+    hir::ExprId expr;
+    std::size_t parent;
+    std::size_t rank{0};
+    hir::Type type{hir::TypeKind::Infer};
+    // The expression which gave the class its real type, used for diagnostic notes.
+    hir::ExprId type_source{0};
+    // The widest integer literal in the class, used as the type if nothing else constrains it.
+    std::size_t bit_width{0};
+    bool has_literal{false};
 };
 
-class Unifier final : public hir::Visitor {
+// Unifies the constraints of a single function. Type variables are only created for the expressions that appear in a
+// constraint, and the only expressions outside of the function that can appear are the parameters of its callees, which
+// are never written to. If report is false, the first error makes run return false instead of emitting a diagnostic.
+class Unifier {
     hir::Root &m_root;
-    std::vector<coel::Stack<Constraint>> &m_constraints;
+    std::unordered_map<hir::ExprId, std::size_t> m_var_map;
+    std::vector<TypeVar> m_vars;
+    bool m_report{true};
 
-    void analyse_binary(hir::ExprId lhs_id, hir::ExprId rhs_id);
-    void analyse_block(const coel::List<hir::Stmt> &stmts);
-    void analyse_call(const hir::Function *callee, const hir::ExprId *arg_ids);
-    void analyse_match(hir::ExprId matchee_id, const std::pair<hir::ExprId, hir::ExprId> *arms, std::size_t arm_count);
-    void analyse_expr(hir::ExprId id);
+    std::size_t var(hir::ExprId id);
+    std::size_t find(std::size_t var);
+    bool unify(const CastEdge &edge);
 
 public:
-    Unifier(hir::Root &root, std::vector<coel::Stack<Constraint>> &constraints)
-        : m_root(root), m_constraints(constraints) {}
+    explicit Unifier(hir::Root &root) : m_root(root) {}
 
-    void visit(const hir::DeclStmt &decl_stmt) override;
-    void visit(const hir::Function &function) override;
-    void visit(const hir::ReturnStmt &return_stmt) override;
+    bool run(const std::vector<CastEdge> &edges, const std::vector<WidthConstraint> &widths, bool report);
+};
+
+// The scratch storage for analysing one function at a time, owned by a single thread.
+class FunctionAnalyser {
+    hir::Root &m_root;
+    Constrainer m_constrainer;
+    Unifier m_unifier;
+
+public:
+    explicit FunctionAnalyser(hir::Root &root) : m_root(root), m_constrainer(root), m_unifier(root) {}
+
+    bool analyse(const hir::Function &function, bool report);
 };
 
 std::string type_string(const coel::ir::Type *type) {
@@ -100,41 +126,44 @@ std::string type_string(const hir::Type &type) {
 }
 
 void Constrainer::analyse_binary(hir::ExprId id, hir::ExprId lhs_id, hir::ExprId rhs_id) {
-    analyse_expr(lhs_id);
-    analyse_expr(rhs_id);
-    m_constraints[lhs_id].emplace(ConstraintKind::ImplicitlyCastable, id);
-    m_constraints[rhs_id].emplace(ConstraintKind::ImplicitlyCastable, id);
+    m_worklist.push_back(lhs_id);
+    m_worklist.push_back(rhs_id);
+    m_edges.push_back({lhs_id, id});
+    m_edges.push_back({rhs_id, id});
 }
 
-void Constrainer::analyse_block(const coel::List<hir::Stmt> &stmts) {
-    for (const auto *stmt : stmts) {
-        stmt->accept(this);
+void Constrainer::analyse_block(hir::ExprId id, std::span<const hir::Stmt> stmts, std::optional<hir::ExprId> value) {
+    for (const auto &stmt : stmts) {
+        stmt.accept(this);
+    }
+    if (value) {
+        m_worklist.push_back(*value);
+        m_edges.push_back({*value, id});
     }
 }
 
-void Constrainer::analyse_call(hir::ExprId id, const hir::Function *callee, const hir::ExprId *arg_ids) {
-    m_constraints[id].emplace(m_root.type(callee->block()));
+void Constrainer::analyse_call(const hir::Function *callee, std::span<const hir::ExprId> arg_ids) {
     for (std::size_t i = 0; i < callee->params().size(); i++) {
         hir::ExprId arg_id = arg_ids[i];
-        analyse_expr(arg_id);
-        m_constraints[arg_id].emplace(ConstraintKind::ImplicitlyCastable, callee->params()[i]);
+        m_worklist.push_back(arg_id);
+        m_edges.push_back({arg_id, callee->params()[i]});
     }
 }
 
 void Constrainer::analyse_constant(hir::ExprId id, std::size_t value) {
-    auto bit_width = static_cast<std::size_t>(std::ceil(std::log2(std::max(value, 1ul))));
-    m_constraints[id].emplace(ConstraintKind::IntegerWidth, bit_width);
+    // The narrowest width which can hold the value, e.g. 4 needs three bits.
+    m_widths.push_back({id, std::max(static_cast<std::size_t>(std::bit_width(value)), std::size_t(1))});
 }
 
-void Constrainer::analyse_match(hir::ExprId id, hir::ExprId matchee_id, const std::pair<hir::ExprId, hir::ExprId> *arms,
-                                std::size_t arm_count) {
-    analyse_expr(matchee_id);
-    for (std::size_t i = 0; i < arm_count; i++) {
-        analyse_expr(arms[i].first);
-        analyse_expr(arms[i].second);
-        m_constraints[matchee_id].emplace(ConstraintKind::ImplicitlyCastable, arms[i].first);
-        m_constraints[arms[i].first].emplace(ConstraintKind::ImplicitlyCastable, matchee_id);
-        m_constraints[arms[i].second].emplace(ConstraintKind::ImplicitlyCastable, id);
+void Constrainer::analyse_match(hir::ExprId id, hir::ExprId matchee_id,
+                                std::span<const std::pair<hir::ExprId, hir::ExprId>> arms) {
+    m_matches.push_back(id);
+    m_worklist.push_back(matchee_id);
+    for (auto [lhs, rhs] : arms) {
+        m_worklist.push_back(lhs);
+        m_worklist.push_back(rhs);
+        m_edges.push_back({lhs, matchee_id});
+        m_edges.push_back({rhs, id});
     }
 }
 
@@ -143,200 +172,322 @@ void Constrainer::analyse_var(hir::ExprId) {
 }
 
 void Constrainer::analyse_expr(hir::ExprId id) {
-    auto &expr = m_root.expr(id);
+    const auto expr = m_root.expr(id);
     switch (expr.kind()) {
     case hir::ExprKind::Argument:
         break;
     case hir::ExprKind::Add:
     case hir::ExprKind::Sub:
+    case hir::ExprKind::Range:
         analyse_binary(id, expr.binary_lhs(), expr.binary_rhs());
         break;
     case hir::ExprKind::Block:
-        analyse_block(expr.block_stmts());
+        analyse_block(id, m_root.block_stmts(id), expr.block_value());
         break;
     case hir::ExprKind::Call:
-        analyse_call(id, expr.call_callee(), expr.call_args());
+        analyse_call(expr.call_callee(), m_root.call_args(id));
         break;
     case hir::ExprKind::Constant:
         analyse_constant(id, expr.constant_value());
         break;
     case hir::ExprKind::Match:
-        analyse_match(id, expr.match_matchee(), expr.match_arms(), expr.match_arm_count());
+        analyse_match(id, expr.match_matchee(), m_root.match_arms(id));
         break;
     case hir::ExprKind::Var:
         analyse_var(id);
         break;
+    case hir::ExprKind::Wildcard:
+        break;
     }
 }
 
 void Constrainer::visit(const hir::DeclStmt &decl_stmt) {
-    analyse_expr(decl_stmt.value());
-    m_constraints[decl_stmt.value()].emplace(ConstraintKind::ImplicitlyCastable, decl_stmt.var());
+    m_worklist.push_back(decl_stmt.value());
+    m_edges.push_back({decl_stmt.value(), decl_stmt.var()});
 }
 
 void Constrainer::visit(const hir::Function &function) {
     m_function = &function;
-    for (hir::ExprId param : function.params()) {
-        m_constraints[param].emplace(m_root.type(param));
+    // The constraints don't depend on the order in which expressions are visited, so an explicit worklist is used
+    // rather than recursion, which could overflow the native stack on deeply nested expressions.
+    m_worklist.push_back(function.block());
+    while (!m_worklist.empty()) {
+        auto id = m_worklist.back();
+        m_worklist.pop_back();
+        analyse_expr(id);
     }
-    analyse_expr(function.block());
 }
 
 void Constrainer::visit(const hir::ReturnStmt &return_stmt) {
-    analyse_expr(return_stmt.value());
-    m_constraints[return_stmt.value()].emplace(ConstraintKind::ImplicitlyCastable, m_function->block());
+    m_worklist.push_back(return_stmt.value());
+    m_edges.push_back({return_stmt.value(), m_function->block()});
 }
 
-void Unifier::analyse_binary(hir::ExprId lhs_id, hir::ExprId rhs_id) {
-    analyse_expr(lhs_id);
-    analyse_expr(rhs_id);
+void Constrainer::clear() {
+    m_edges.clear();
+    m_widths.clear();
+    m_matches.clear();
 }
 
-void Unifier::analyse_block(const coel::List<hir::Stmt> &stmts) {
-    for (const auto *stmt : stmts) {
-        stmt->accept(this);
+std::size_t Unifier::var(hir::ExprId id) {
+    // Every expression starts off in its own class. Expressions with an explicit type (parameters, function blocks and
+    // calls) seed their class with it.
+    auto [it, inserted] = m_var_map.emplace(id, m_vars.size());
+    if (inserted) {
+        auto &var = m_vars.emplace_back();
+        var.expr = id;
+        var.parent = it->second;
+        var.type = m_root.type(id);
+        var.type_source = id;
     }
+    return it->second;
 }
 
-void Unifier::analyse_call(const hir::Function *callee, const hir::ExprId *arg_ids) {
-    for (std::size_t i = 0; i < callee->params().size(); i++) {
-        analyse_expr(arg_ids[i]);
+std::size_t Unifier::find(std::size_t var) {
+    while (m_vars[var].parent != var) {
+        // Path halving.
+        m_vars[var].parent = m_vars[m_vars[var].parent].parent;
+        var = m_vars[var].parent;
     }
+    return var;
 }
 
-void Unifier::analyse_match(hir::ExprId matchee_id, const std::pair<hir::ExprId, hir::ExprId> *arms,
-                            std::size_t arm_count) {
-    analyse_expr(matchee_id);
-    for (std::size_t i = 0; i < arm_count; i++) {
-        analyse_expr(arms[i].first);
-        analyse_expr(arms[i].second);
+bool Unifier::unify(const CastEdge &edge) {
+    auto from = find(var(edge.from));
+    auto to = find(var(edge.to));
+    if (from == to) {
+        return true;
+    }
+    if (m_vars[from].type.is_real() && m_vars[to].type.is_real() && m_vars[from].type != m_vars[to].type) {
+        if (!m_report) {
+            return false;
+        }
+        Diagnostic diagnostic(m_root.location(edge.from), "cannot implicitly cast from {} to {}",
+                              type_string(m_vars[from].type), type_string(m_vars[to].type));
+        diagnostic.add_note(m_root.location(edge.to), "constrained here");
     }
+
+    // Union by rank, keeping whichever real type is known.
+    if (m_vars[from].rank > m_vars[to].rank) {
+        std::swap(from, to);
+    }
+    auto &child = m_vars[from];
+    auto &parent = m_vars[to];
+    child.parent = to;
+    if (child.rank == parent.rank) {
+        parent.rank++;
+    }
+    if (parent.type.is_infer() ||
+        (child.type.is_real() && m_root.kind(child.type_source) == hir::ExprKind::Argument)) {
+        parent.type = child.type;
+        parent.type_source = child.type_source;
+    }
+    if (child.has_literal) {
+        parent.bit_width = std::max(parent.bit_width, child.bit_width);
+        parent.has_literal = true;
+    }
+    return true;
 }
 
-void Unifier::analyse_expr(hir::ExprId id) {
-    auto &expr = m_root.expr(id);
-    if (expr.kind() == hir::ExprKind::Block) {
-        COEL_ASSERT(m_constraints[id].empty());
-        analyse_block(expr.block_stmts());
-        return;
+bool Unifier::run(const std::vector<CastEdge> &edges, const std::vector<WidthConstraint> &widths, bool report) {
+    m_var_map.clear();
+    m_vars.clear();
+    m_report = report;
+    for (const auto &width : widths) {
+        auto &literal = m_vars[var(width.expr)];
+        literal.bit_width = width.bit_width;
+        literal.has_literal = true;
     }
-    if (expr.kind() == hir::ExprKind::Var && m_constraints[id].empty()) {
-        return;
+    for (const auto &edge : edges) {
+        if (!unify(edge)) {
+            return false;
+        }
     }
 
-    std::vector<Constraint> visited_constraints;
-    do {
-        auto c1 = m_constraints[id].pop();
-        switch (c1.kind()) {
-        case ConstraintKind::Equals: {
-            expr.set_type(c1.equals_type());
-            for (const auto &c2 : visited_constraints) {
-                switch (c2.kind()) {
-                case ConstraintKind::ImplicitlyCastable: {
-                    const auto &cast_to = m_root.type(c2.implicitly_castable_expr());
-                    if (expr.type() != cast_to) {
-                        Diagnostic diagnostic(expr.location(), "cannot implicitly cast from {} to {}",
-                                              type_string(expr.type()), type_string(cast_to));
-                        auto &constraining_expr = m_root.expr(c2.implicitly_castable_expr());
-                        diagnostic.add_note(constraining_expr.location(), "constrained here");
-                    }
-                    break;
-                }
-                default:
-                    COEL_ENSURE_NOT_REACHED();
-                }
-            }
-            break;
+    // Classes without a real type take the type of their widest literal.
+    for (std::size_t i = 0; i < m_vars.size(); i++) {
+        auto &root_var = m_vars[find(i)];
+        if (root_var.type.is_infer() && root_var.has_literal) {
+            // coel's type cache isn't thread-safe.
+            std::scoped_lock lock(s_type_mutex);
+            root_var.type = coel::ir::IntegerType::get(root_var.bit_width);
+            root_var.type_source = m_vars[i].expr;
         }
-        case ConstraintKind::ImplicitlyCastable: {
-            // TODO: Check visited_constraints.
-            if (!expr.type().is_real()) {
-                expr.set_type(m_root.type(c1.implicitly_castable_expr()));
-            }
-            break;
+    }
+
+    for (const auto &width : widths) {
+        const auto &root_var = m_vars[find(var(width.expr))];
+        const auto expr = m_root.expr(width.expr);
+        const auto *cast_to = root_var.type.real()->as<coel::ir::IntegerType>();
+        if ((cast_to == nullptr || cast_to->bit_width() < width.bit_width) && !m_report) {
+            return false;
         }
-        case ConstraintKind::IntegerWidth:
-            expr.set_type(coel::ir::IntegerType::get(c1.integer_width_bit_width()));
-            for (const auto &c2 : visited_constraints) {
-                switch (c2.kind()) {
-                case ConstraintKind::ImplicitlyCastable: {
-                    const auto &cast_to_hir = m_root.type(c2.implicitly_castable_expr());
-                    if (cast_to_hir.is_infer()) {
-                        break;
-                    }
-                    const auto *cast_to = cast_to_hir.real()->as<coel::ir::IntegerType>();
-                    if (cast_to == nullptr) {
-                        COEL_ENSURE_NOT_REACHED("Integer type needs to be castable to a non-integer");
-                    }
-                    if (cast_to->bit_width() < c1.integer_width_bit_width()) {
-                        Diagnostic diagnostic(expr.location(), "implicit truncation from {} to {} is not allowed",
-                                              expr.kind() == hir::ExprKind::Constant
-                                                  ? fmt::format("the literal '{}' (u{})", expr.constant_value(),
-                                                                c1.integer_width_bit_width())
-                                                  : fmt::format("a u{}", c1.integer_width_bit_width()),
-                                              type_string(cast_to));
-                        auto &constraining_expr = m_root.expr(c2.implicitly_castable_expr());
-                        if (constraining_expr.kind() == hir::ExprKind::Argument) {
-                            diagnostic.add_note(constraining_expr.location(), "parameter declared as {} here",
-                                                type_string(cast_to));
-                        }
-                    }
-                    expr.set_type(cast_to);
-                    break;
-                }
-                default:
-                    COEL_ENSURE_NOT_REACHED();
-                }
+        if (cast_to == nullptr) {
+            Diagnostic(expr.location(), "cannot implicitly cast from the literal '{}' to {}", expr.constant_value(),
+                       type_string(root_var.type));
+        }
+        if (cast_to->bit_width() < width.bit_width) {
+            Diagnostic diagnostic(expr.location(),
+                                  "implicit truncation from the literal '{}' (u{}) to {} is not allowed",
+                                  expr.constant_value(), width.bit_width, type_string(cast_to));
+            const auto constraining_expr = m_root.expr(root_var.type_source);
+            if (constraining_expr.kind() == hir::ExprKind::Argument) {
+                diagnostic.add_note(constraining_expr.location(), "parameter declared as {} here",
+                                    type_string(cast_to));
             }
-            break;
-        default:
-            COEL_ENSURE_NOT_REACHED();
         }
-        visited_constraints.push_back(c1);
-    } while (!m_constraints[id].empty());
+    }
 
-    switch (expr.kind()) {
-    case hir::ExprKind::Add:
-    case hir::ExprKind::Sub:
-        analyse_binary(expr.binary_lhs(), expr.binary_rhs());
-        break;
-    case hir::ExprKind::Call:
-        analyse_call(expr.call_callee(), expr.call_args());
-        break;
-    case hir::ExprKind::Match:
-        analyse_match(expr.match_matchee(), expr.match_arms(), expr.match_arm_count());
-        break;
-    default:
-        break;
+    // Write back the inferred types. Arguments are skipped since they already have their declared type, and since the
+    // parameters of callees are owned by other functions.
+    for (std::size_t i = 0; i < m_vars.size(); i++) {
+        const auto id = m_vars[i].expr;
+        if (m_root.kind(id) != hir::ExprKind::Argument) {
+            m_root.set_type(id, m_vars[find(i)].type);
+        }
     }
+    return true;
 }
 
-void Unifier::visit(const hir::DeclStmt &decl_stmt) {
-    analyse_expr(decl_stmt.var());
-    analyse_expr(decl_stmt.value());
-    auto &var = m_root.expr(decl_stmt.var());
-    if (var.type().is_infer()) {
-        var.set_type(m_root.type(decl_stmt.value()));
+// A set of integer values, stored as disjoint intervals which are merged whenever they overlap or touch.
+class ValueSet {
+    std::map<std::size_t, std::size_t> m_intervals;
+    std::size_t m_size{0};
+
+public:
+    bool contains(std::size_t first, std::size_t last) const;
+    void insert(std::size_t first, std::size_t last);
+
+    // Only meaningful if the set doesn't span the whole 64-bit range.
+    std::size_t size() const { return m_size; }
+};
+
+bool ValueSet::contains(std::size_t first, std::size_t last) const {
+    auto it = m_intervals.upper_bound(first);
+    return it != m_intervals.begin() && std::prev(it)->second >= last;
+}
+
+void ValueSet::insert(std::size_t first, std::size_t last) {
+    auto it = m_intervals.upper_bound(first);
+    if (it != m_intervals.begin() && (std::prev(it)->second >= first || std::prev(it)->second + 1 == first)) {
+        --it;
+    }
+    while (it != m_intervals.end() && (it->first <= last || it->first == last + 1)) {
+        first = std::min(first, it->first);
+        last = std::max(last, it->second);
+        m_size -= it->second - it->first + 1;
+        it = m_intervals.erase(it);
     }
+    m_intervals.emplace(first, last);
+    m_size += last - first + 1;
 }
 
-void Unifier::visit(const hir::Function &function) {
-    analyse_expr(function.block());
+// Checks that no arm of a typed match follows a default arm, or has a constant or range pattern which only matches
+// values matched by earlier arms. Arms after those which already cover every value of the matchee's type can never be
+// reached, so are dropped, and the match is marked as exhaustive. Arms whose pattern is any other expression never
+// count towards the values covered.
+bool check_match(hir::Root &root, hir::ExprId id, bool report) {
+    const auto arms = root.match_arms(id);
+    const auto *matchee_type = root.type(root.expr(id).match_matchee()).real()->as<coel::ir::IntegerType>();
+    const auto value_count = matchee_type != nullptr && matchee_type->bit_width() < 64
+                                 ? std::size_t(1) << matchee_type->bit_width()
+                                 : 0;
+    ValueSet covered;
+    for (std::size_t i = 0; i < arms.size(); i++) {
+        const auto pattern = root.expr(arms[i].first);
+        if (pattern.kind() == hir::ExprKind::Wildcard) {
+            if (i + 1 != arms.size()) {
+                if (!report) {
+                    return false;
+                }
+                Diagnostic diagnostic(root.location(arms[i + 1].first), "unreachable match arm");
+                diagnostic.add_note(pattern.location(), "default arm here");
+            }
+            root.set_match_exhaustive(id, i + 1);
+            return true;
+        }
+        auto values = root.pattern_values(arms[i].first);
+        if (!values) {
+            continue;
+        }
+        const auto [first, last] = *values;
+        if (covered.contains(first, last)) {
+            if (!report) {
+                return false;
+            }
+            auto message = first == last ? fmt::format("pattern '{}' is already matched", first)
+                                         : fmt::format("range pattern '{}..={}' is already matched", first, last);
+            Diagnostic diagnostic(pattern.location(), "unreachable match arm, {}", message);
+            for (std::size_t j = 0; j < i; j++) {
+                auto earlier = root.pattern_values(arms[j].first);
+                if (earlier && earlier->first <= last && earlier->second >= first) {
+                    diagnostic.add_note(root.location(arms[j].first), "first matched here");
+                    break;
+                }
+            }
+        }
+        covered.insert(first, last);
+        if (covered.size() == value_count) {
+            root.set_match_exhaustive(id, i + 1);
+            return true;
+        }
+    }
+    return true;
 }
 
-void Unifier::visit(const hir::ReturnStmt &return_stmt) {
-    analyse_expr(return_stmt.value());
+bool FunctionAnalyser::analyse(const hir::Function &function, bool report) {
+    m_constrainer.clear();
+    function.accept(&m_constrainer);
+    if (!m_unifier.run(m_constrainer.edges(), m_constrainer.widths(), report)) {
+        return false;
+    }
+    return std::all_of(m_constrainer.matches().begin(), m_constrainer.matches().end(), [&](hir::ExprId id) {
+        return check_match(m_root, id, report);
+    });
 }
 
 } // namespace
 
-void analyse_hir(hir::Root &root) {
-    Constrainer constrainer(root);
-    for (auto *function : root) {
-        function->accept(&constrainer);
+void analyse_hir(hir::Root &root, unsigned thread_count) {
+    std::vector<const hir::Function *> functions;
+    for (const auto *function : root) {
+        functions.push_back(function);
     }
-    Unifier unifier(root, constrainer.constraints());
-    for (auto *function : root) {
-        function->accept(&unifier);
+    thread_count = std::clamp(thread_count, 1u, static_cast<unsigned>(std::max(functions.size(), 1ul)));
+    if (thread_count == 1) {
+        FunctionAnalyser analyser(root);
+        for (const auto *function : functions) {
+            analyser.analyse(*function, true);
+        }
+        return;
+    }
+
+    // Since every function's signature is explicit, functions can be analysed independently. Each worker only writes
+    // to the types of the expressions of the functions it takes.
+    std::atomic<std::size_t> next_function{0};
+    std::vector<char> failed(functions.size(), 0);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < thread_count; i++) {
+        workers.emplace_back([&] {
+            FunctionAnalyser analyser(root);
+            for (auto index = next_function++; index < functions.size(); index = next_function++) {
+                failed[index] = analyser.analyse(*functions[index], false) ? 0 : 1;
+            }
+        });
     }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    // Report the error of the first failing function, as the serial analysis would have.
+    auto it = std::find(failed.begin(), failed.end(), 1);
+    if (it != failed.end()) {
+        FunctionAnalyser analyser(root);
+        analyser.analyse(*functions[static_cast<std::size_t>(it - failed.begin())], true);
+    }
+}
+
+void analyse_function(hir::Root &root, const hir::Function &function) {
+    FunctionAnalyser analyser(root);
+    analyser.analyse(function, true);
 }
@@ -2,8 +2,14 @@
 
 namespace hir {
 
+class Function;
 class Root;
 
 } // namespace hir
 
-void analyse_hir(hir::Root &root);
+// Infers and checks the types of every expression. If thread_count is greater than one, functions are analysed in
+// parallel.
+void analyse_hir(hir::Root &root, unsigned thread_count);
+
+// Infers and checks the types of a single function's expressions.
+void analyse_function(hir::Root &root, const hir::Function &function);
@@ -7,6 +7,7 @@
 
 #include <cstddef>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -164,15 +165,24 @@ public:
 };
 
 class MatchArm {
+    SourceLocation m_location;
     std::unique_ptr<const Node> m_lhs;
     std::unique_ptr<const Node> m_rhs;
+    std::optional<std::size_t> m_range_last;
 
 public:
-    MatchArm(std::unique_ptr<const Node> &&lhs, std::unique_ptr<const Node> &&rhs)
-        : m_lhs(std::move(lhs)), m_rhs(std::move(rhs)) {}
-
+    MatchArm(const SourceLocation &location, std::unique_ptr<const Node> &&lhs, std::unique_ptr<const Node> &&rhs,
+             std::optional<std::size_t> range_last)
+        : m_location(location), m_lhs(std::move(lhs)), m_rhs(std::move(rhs)), m_range_last(range_last) {}
+
+    // A default arm (`_ =>`) has no pattern.
+    bool is_default() const { return m_lhs == nullptr; }
+    // A range pattern has an integer literal lhs as its first value, and an inclusive last value.
+    bool is_range() const { return m_range_last.has_value(); }
+    const SourceLocation &location() const { return m_location; }
     const Node &lhs() const { return *m_lhs; }
     const Node &rhs() const { return *m_rhs; }
+    std::size_t range_last() const { return *m_range_last; }
 };
 
 class MatchExpr : public Node {
@@ -184,8 +194,9 @@ public:
         : Node(location), m_matchee(std::move(matchee)) {}
 
     void accept(Visitor *visitor) const override;
-    void add_arm(std::unique_ptr<const Node> &&lhs, std::unique_ptr<const Node> &&rhs) {
-        m_arms.emplace_back(std::move(lhs), std::move(rhs));
+    void add_arm(const SourceLocation &location, std::unique_ptr<const Node> &&lhs, std::unique_ptr<const Node> &&rhs,
+                 std::optional<std::size_t> range_last = std::nullopt) {
+        m_arms.emplace_back(location, std::move(lhs), std::move(rhs), range_last);
     }
 
     const Node &matchee() const { return *m_matchee; }
@@ -3,58 +3,40 @@
 #include <Ast.hh>
 #include <Diagnostic.hh>
 #include <Hir.hh>
+#include <SymbolTable.hh>
 
 #include <coel/ir/Types.hh>
 #include <coel/support/Stack.hh>
 
-#include <optional>
+#include <algorithm>
+#include <cstddef>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace {
 
-enum class ScopeKind {
-    Block,
-    Function,
-    Root,
-};
-
-class Scope {
-    hir::Root &m_root;
-    Scope *&m_current;
-    Scope *const m_parent;
-    const ScopeKind m_kind;
-    std::unordered_map<std::string_view, hir::ExprId> m_symbol_map;
-
-public:
-    Scope(hir::Root &root, Scope *&current, ScopeKind kind)
-        : m_root(root), m_current(current), m_parent(current), m_kind(kind) {
-        current = this;
-    }
-    Scope(const Scope &) = delete;
-    Scope(Scope &&) = delete;
-    ~Scope() { m_current = m_parent; }
-
-    Scope &operator=(const Scope &) = delete;
-    Scope &operator=(Scope &&) = delete;
-
-    std::optional<hir::ExprId> find_symbol(std::string_view name) const;
-    hir::ExprId lookup_symbol(const SourceLocation &location, std::string_view name) const;
-    void put_symbol(const SourceLocation &location, std::string_view name, hir::ExprId id);
-
-    const Scope *parent() const { return m_parent; }
-    ScopeKind kind() const { return m_kind; }
-};
-
+// Nodes are lowered with an explicit worklist rather than by recursion so that deeply nested expressions can't overflow
+// the native stack. Each node with children is visited twice: once on entry, where it schedules its exit followed by
+// its children, and once on exit, where it pops the lowered children off of the expression stack.
 class AstLowering final : public ast::Visitor {
     hir::Root m_root;
     hir::Function *m_function{nullptr};
     hir::ExprId m_block{0};
     coel::Stack<hir::ExprId> m_expr_stack;
     std::unordered_map<std::string_view, hir::Function *> m_function_map;
-    Scope *m_scope{nullptr};
+    SymbolTable m_symbols{m_root};
+    std::vector<std::pair<const ast::Node *, bool>> m_worklist;
+    bool m_exiting{false};
+    std::vector<hir::ExprId> m_arg_buffer;
+    std::vector<std::pair<hir::ExprId, hir::ExprId>> m_arm_buffer;
 
     hir::Type lower_type(const ast::Type &type);
+    void declare_function(const ast::FunctionDecl &function_decl);
+    bool schedule_exit(const ast::Node &node);
+    void schedule_children(std::size_t mark);
+    void lower(const ast::Node &node);
 
 public:
     void visit(const ast::BinaryExpr &binary_expr) override;
@@ -72,40 +54,53 @@ public:
     hir::Root &root() { return m_root; }
 };
 
-std::optional<hir::ExprId> Scope::find_symbol(std::string_view name) const {
-    for (const auto *scope = this; scope != nullptr; scope = scope->m_parent) {
-        if (scope->m_symbol_map.contains(name)) {
-            return scope->m_symbol_map.at(name);
+hir::Type AstLowering::lower_type(const ast::Type &type) {
+    if (const auto *base_type = type.as<ast::BaseType>()) {
+        const auto &name = base_type->name();
+        if (name.starts_with('u')) {
+            // TODO: substr is making a copy here, need stoi that works with string_view.
+            return coel::ir::IntegerType::get(std::stoi(name.substr(1)));
         }
     }
-    return std::nullopt;
+    COEL_ENSURE_NOT_REACHED();
 }
 
-hir::ExprId Scope::lookup_symbol(const SourceLocation &location, std::string_view name) const {
-    if (auto symbol = find_symbol(name)) {
-        return *symbol;
+void AstLowering::declare_function(const ast::FunctionDecl &function_decl) {
+    std::vector<hir::ExprId> params;
+    for (std::size_t i = 0; const auto &arg : function_decl.args()) {
+        params.push_back(m_root.create_expr(arg.location(), hir::ExprKind::Argument, lower_type(arg.type()), i++));
+    }
+    auto *function = m_root.append_function(function_decl.name(), std::move(params));
+    function->set_block(
+        m_root.create_expr(function_decl.location(), hir::ExprKind::Block, lower_type(function_decl.return_type())));
+    if (auto [it, inserted] = m_function_map.emplace(function_decl.name(), function); !inserted) {
+        Diagnostic diagnostic(function_decl.location(), "attempted redeclaration of function '{}'",
+                              function_decl.name());
+        diagnostic.add_note(m_root.location(it->second->block()), "function originally declared here");
     }
-    Diagnostic(location, "attempted use of undeclared symbol '{}'", name);
-    COEL_ENSURE_NOT_REACHED();
 }
 
-void Scope::put_symbol(const SourceLocation &location, std::string_view name, hir::ExprId id) {
-    if (auto existing = find_symbol(name)) {
-        Diagnostic diagnostic(location, "attempted redeclaration of symbol '{}'", name);
-        diagnostic.add_note(m_root.expr(*existing).location(), "symbol originally declared here");
+bool AstLowering::schedule_exit(const ast::Node &node) {
+    if (m_exiting) {
+        return false;
     }
-    m_symbol_map.emplace(name, id);
+    m_worklist.emplace_back(&node, true);
+    return true;
 }
 
-hir::Type AstLowering::lower_type(const ast::Type &type) {
-    if (const auto *base_type = type.as<ast::BaseType>()) {
-        const auto &name = base_type->name();
-        if (name.starts_with('u')) {
-            // TODO: substr is making a copy here, need stoi that works with string_view.
-            return coel::ir::IntegerType::get(std::stoi(name.substr(1)));
-        }
+void AstLowering::schedule_children(std::size_t mark) {
+    // Children are pushed in order, so reverse them to have the first child lowered first.
+    std::reverse(m_worklist.begin() + static_cast<std::ptrdiff_t>(mark), m_worklist.end());
+}
+
+void AstLowering::lower(const ast::Node &node) {
+    m_worklist.emplace_back(&node, false);
+    while (!m_worklist.empty()) {
+        auto [next, exiting] = m_worklist.back();
+        m_worklist.pop_back();
+        m_exiting = exiting;
+        next->accept(this);
     }
-    COEL_ENSURE_NOT_REACHED();
 }
 
 void AstLowering::visit(const ast::BinaryExpr &binary_expr) {
@@ -117,52 +112,69 @@ void AstLowering::visit(const ast::BinaryExpr &binary_expr) {
             return hir::ExprKind::Sub;
         }
     };
-    binary_expr.lhs().accept(this);
-    binary_expr.rhs().accept(this);
+    if (schedule_exit(binary_expr)) {
+        m_worklist.emplace_back(&binary_expr.rhs(), false);
+        m_worklist.emplace_back(&binary_expr.lhs(), false);
+        return;
+    }
     auto rhs = m_expr_stack.pop();
     auto lhs = m_expr_stack.pop();
     m_expr_stack.push(m_root.create_expr(binary_expr.location(), binary_op(binary_expr.op()), lhs, rhs));
 }
 
 void AstLowering::visit(const ast::Block &block) {
-    Scope scope(m_root, m_scope, ScopeKind::Block);
+    if (!schedule_exit(block)) {
+        m_symbols.leave_scope();
+        return;
+    }
+    m_symbols.enter_scope(ScopeKind::Block);
+    const auto mark = m_worklist.size();
     for (const auto *stmt : block) {
-        stmt->accept(this);
+        m_worklist.emplace_back(stmt, false);
     }
+    schedule_children(mark);
 }
 
 void AstLowering::visit(const ast::CallExpr &call_expr) {
-    auto *args = new hir::ExprId[call_expr.args().size()];
-    for (std::size_t i = 0; const auto *arg : call_expr.args()) {
-        arg->accept(this);
-        args[i++] = m_expr_stack.pop();
+    if (schedule_exit(call_expr)) {
+        const auto mark = m_worklist.size();
+        for (const auto *arg : call_expr.args()) {
+            m_worklist.emplace_back(arg, false);
+        }
+        schedule_children(mark);
+        return;
+    }
+    m_arg_buffer.resize(call_expr.args().size());
+    for (auto it = m_arg_buffer.rbegin(); it != m_arg_buffer.rend(); ++it) {
+        *it = m_expr_stack.pop();
     }
     auto *callee = m_function_map.at(call_expr.callee().name());
-    m_expr_stack.push(m_root.create_expr(call_expr.location(), callee, m_root.type(callee->block()), args));
+    m_expr_stack.push(m_root.create_call(call_expr.location(), callee, m_root.type(callee->block()), m_arg_buffer));
 }
 
 void AstLowering::visit(const ast::DeclStmt &decl_stmt) {
-    decl_stmt.value().accept(this);
+    if (schedule_exit(decl_stmt)) {
+        m_worklist.emplace_back(&decl_stmt.value(), false);
+        return;
+    }
     COEL_ASSERT(m_expr_stack.size() == 1);
     auto var = m_root.create_expr(decl_stmt.location(), hir::ExprKind::Var, hir::TypeKind::Infer);
-    m_root.expr(m_block).append<hir::DeclStmt>(var, m_expr_stack.pop());
-    m_scope->put_symbol(decl_stmt.location(), decl_stmt.name(), var);
+    m_root.append_stmt(m_block, hir::DeclStmt(var, m_expr_stack.pop()));
+    m_symbols.put_symbol(decl_stmt.location(), decl_stmt.name(), var);
 }
 
 void AstLowering::visit(const ast::FunctionDecl &function_decl) {
-    Scope scope(m_root, m_scope, ScopeKind::Function);
-    std::vector<hir::ExprId> params;
+    if (!schedule_exit(function_decl)) {
+        m_symbols.leave_scope();
+        return;
+    }
+    m_symbols.enter_scope(ScopeKind::Function);
+    m_function = m_function_map.at(function_decl.name());
+    m_block = m_function->block();
     for (std::size_t i = 0; const auto &arg : function_decl.args()) {
-        auto argument = m_root.create_expr(arg.location(), hir::ExprKind::Argument, lower_type(arg.type()), i++);
-        m_scope->put_symbol(arg.location(), arg.name(), argument);
-        params.push_back(argument);
+        m_symbols.put_symbol(arg.location(), arg.name(), m_function->params()[i++]);
     }
-    m_function = m_root.append_function(function_decl.name(), std::move(params));
-    m_block =
-        m_root.create_expr(function_decl.location(), hir::ExprKind::Block, lower_type(function_decl.return_type()));
-    m_function->set_block(m_block);
-    m_function_map.emplace(function_decl.name(), m_function);
-    function_decl.block().accept(this);
+    m_worklist.emplace_back(&function_decl.block(), false);
 }
 
 void AstLowering::visit(const ast::IntegerLiteral &integer_literal) {
@@ -170,40 +182,68 @@ void AstLowering::visit(const ast::IntegerLiteral &integer_literal) {
 }
 
 void AstLowering::visit(const ast::MatchExpr &match_expr) {
-    match_expr.matchee().accept(this);
-    auto matchee = m_expr_stack.pop();
-    auto *arms = new std::pair<hir::ExprId, hir::ExprId>[match_expr.arms().size()];
-    for (std::size_t i = 0; const auto &arm : match_expr.arms()) {
-        arm.lhs().accept(this);
-        auto lhs = m_expr_stack.pop();
-        arm.rhs().accept(this);
+    if (schedule_exit(match_expr)) {
+        const auto mark = m_worklist.size();
+        m_worklist.emplace_back(&match_expr.matchee(), false);
+        for (const auto &arm : match_expr.arms()) {
+            if (!arm.is_default()) {
+                m_worklist.emplace_back(&arm.lhs(), false);
+            }
+            m_worklist.emplace_back(&arm.rhs(), false);
+        }
+        schedule_children(mark);
+        return;
+    }
+    m_arm_buffer.resize(match_expr.arms().size());
+    for (std::size_t i = m_arm_buffer.size(); i > 0; i--) {
+        const auto &arm = match_expr.arms()[i - 1];
         auto rhs = m_expr_stack.pop();
-        arms[i++] = {lhs, rhs};
+        auto lhs = arm.is_default()
+                       ? m_root.create_expr(arm.location(), hir::ExprKind::Wildcard, hir::TypeKind::Infer)
+                       : m_expr_stack.pop();
+        if (arm.is_range()) {
+            const auto location = m_root.location(lhs);
+            auto last = m_root.create_expr(location, hir::ExprKind::Constant, arm.range_last());
+            lhs = m_root.create_expr(location, hir::ExprKind::Range, lhs, last);
+        }
+        m_arm_buffer[i - 1] = {lhs, rhs};
     }
-    m_expr_stack.push(m_root.create_expr(match_expr.location(), matchee, arms, match_expr.arms().size()));
+    auto matchee = m_expr_stack.pop();
+    m_expr_stack.push(m_root.create_match(match_expr.location(), matchee, m_arm_buffer));
 }
 
 void AstLowering::visit(const ast::ReturnStmt &return_stmt) {
-    return_stmt.value().accept(this);
-    m_root.expr(m_block).append<hir::ReturnStmt>(m_expr_stack.pop());
+    if (schedule_exit(return_stmt)) {
+        m_worklist.emplace_back(&return_stmt.value(), false);
+        return;
+    }
+    m_root.append_stmt(m_block, hir::ReturnStmt(m_expr_stack.pop()));
 }
 
 void AstLowering::visit(const ast::Root &root) {
-    Scope scope(m_root, m_scope, ScopeKind::Root);
+    m_symbols.enter_scope(ScopeKind::Root);
+    // Declare all functions up front so that calls may refer to functions declared later on.
     for (const auto *function : root) {
-        function->accept(this);
+        declare_function(*function);
     }
+    for (const auto *function : root) {
+        lower(*function);
+    }
+    m_symbols.leave_scope();
 }
 
 void AstLowering::visit(const ast::Symbol &symbol) {
-    m_expr_stack.push(m_scope->lookup_symbol(symbol.location(), symbol.name()));
+    m_expr_stack.push(m_symbols.lookup_symbol(symbol.location(), symbol.name()));
 }
 
 void AstLowering::visit(const ast::YieldStmt &yield_stmt) {
-    yield_stmt.value().accept(this);
-    if (m_scope->parent()->kind() == ScopeKind::Function) {
+    if (schedule_exit(yield_stmt)) {
+        m_worklist.emplace_back(&yield_stmt.value(), false);
+        return;
+    }
+    if (m_symbols.parent_kind() == ScopeKind::Function) {
         // Emit a return statement if yielding from a function.
-        m_root.expr(m_block).append<hir::ReturnStmt>(m_expr_stack.pop());
+        m_root.append_stmt(m_block, hir::ReturnStmt(m_expr_stack.pop()));
     }
 }
 
@@ -0,0 +1,83 @@
+#include <Batch.hh>
+
+#include <Hir.hh>
+#include <NativeCode.hh>
+
+#include <coel/ir/Types.hh>
+#include <coel/support/Assert.hh>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+
+namespace {
+
+// The number of possible u8 values.
+constexpr std::size_t k_table_size = 256;
+
+unsigned bit_width(const hir::Root &root, hir::ExprId expr) {
+    return root.type(expr).real()->as_non_null<coel::ir::IntegerType>()->bit_width();
+}
+
+} // namespace
+
+std::optional<BatchFunction> BatchFunction::compile(const hir::Root &root, const hir::Function &function) {
+    if (function.params().size() > k_register_arg_count) {
+        return std::nullopt;
+    }
+    std::vector<unsigned> param_widths;
+    for (auto param : function.params()) {
+        param_widths.push_back(bit_width(root, param));
+    }
+
+    auto code = compile_native(root, function);
+    if (!code) {
+        return std::nullopt;
+    }
+    return BatchFunction(code->entry, std::move(param_widths), bit_width(root, function.block()));
+}
+
+std::uint64_t BatchFunction::call(std::span<const std::uint64_t> args) const {
+    return m_code(args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+template <typename T>
+void BatchFunction::run_rows(std::span<const std::span<const T>> inputs, std::span<T> output) const {
+    COEL_ASSERT(inputs.size() == m_param_widths.size());
+    for (const auto &input : inputs) {
+        COEL_ASSERT(input.size() >= output.size());
+    }
+    std::array<std::uint64_t, k_register_arg_count> args{};
+    for (std::size_t row = 0; row < output.size(); row++) {
+        for (std::size_t i = 0; i < inputs.size(); i++) {
+            args[i] = inputs[i][row];
+        }
+        output[row] = static_cast<T>(call(args));
+    }
+}
+
+void BatchFunction::run(std::span<const std::span<const std::uint8_t>> inputs, std::span<std::uint8_t> output) const {
+    if (inputs.size() != 1) {
+        run_rows(inputs, output);
+        return;
+    }
+    // Only values which actually appear in the column are evaluated, so that a function which doesn't terminate for
+    // some other value behaves the same as when called for each row.
+    COEL_ASSERT(inputs[0].size() >= output.size());
+    std::array<std::uint8_t, k_table_size> table{};
+    std::bitset<k_table_size> evaluated;
+    std::array<std::uint64_t, k_register_arg_count> args{};
+    std::transform(inputs[0].begin(), inputs[0].begin() + static_cast<std::ptrdiff_t>(output.size()), output.begin(),
+                   [&](std::uint8_t value) {
+                       if (!evaluated[value]) {
+                           args[0] = value;
+                           table[value] = static_cast<std::uint8_t>(call(args));
+                           evaluated[value] = true;
+                       }
+                       return table[value];
+                   });
+}
+
+void BatchFunction::run(std::span<const std::span<const std::uint32_t>> inputs, std::span<std::uint32_t> output) const {
+    run_rows(inputs, output);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <NativeCode.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+// A function compiled to be run over whole columns of values at a time, such as when used as a per-record function over
+// a table. Each input column holds one argument for every row, and one result is written per row. The function is
+// called directly for each row, without going through main. Functions are free of side effects, so a function of a
+// single u8 column is instead evaluated once for each distinct value in the column, and the rest become table lookups.
+class BatchFunction {
+    NativeFunction m_code;
+    std::vector<unsigned> m_param_widths;
+    unsigned m_return_width;
+
+    BatchFunction(NativeFunction code, std::vector<unsigned> &&param_widths, unsigned return_width)
+        : m_code(code), m_param_widths(std::move(param_widths)), m_return_width(return_width) {}
+
+    std::uint64_t call(std::span<const std::uint64_t> args) const;
+    template <typename T>
+    void run_rows(std::span<const std::span<const T>> inputs, std::span<T> output) const;
+
+public:
+    // Compiles function along with every function it can reach. Returns std::nullopt if the function takes more
+    // arguments than can be passed in registers or its code couldn't be mapped.
+    static std::optional<BatchFunction> compile(const hir::Root &root, const hir::Function &function);
+
+    // There must be one input column per parameter, each at least as long as output. Arguments and results which don't
+    // fit in the element type are truncated.
+    void run(std::span<const std::span<const std::uint8_t>> inputs, std::span<std::uint8_t> output) const;
+    void run(std::span<const std::span<const std::uint32_t>> inputs, std::span<std::uint32_t> output) const;
+
+    const std::vector<unsigned> &param_widths() const { return m_param_widths; }
+    unsigned return_width() const { return m_return_width; }
+};
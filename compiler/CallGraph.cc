@@ -0,0 +1,171 @@
+#include <CallGraph.hh>
+
+#include <Hir.hh>
+#include <HirWalker.hh>
+#include <Profile.hh>
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Counts the call sites of each callee within a function, or the calls made from them if a profile is given.
+std::vector<std::pair<const hir::Function *, std::size_t>> collect_callees(const hir::Root &root,
+                                                                           const hir::Function &function,
+                                                                           const Profile *profile) {
+    std::vector<std::pair<const hir::Function *, std::size_t>> callees;
+    std::unordered_map<const hir::Function *, std::size_t> callee_map;
+    for_each_call(root, function, [&](hir::ExprId id) {
+        const auto expr = root.expr(id);
+        auto [it, inserted] = callee_map.emplace(expr.call_callee(), callees.size());
+        if (inserted) {
+            callees.emplace_back(expr.call_callee(), 0);
+        }
+        callees[it->second].second += profile != nullptr ? profile->call_count(expr.location()) : 1;
+    });
+    return callees;
+}
+
+} // namespace
+
+std::vector<const hir::Function *> order_functions(const hir::Root &root, std::string_view entry,
+                                                   const Profile *profile) {
+    std::vector<const hir::Function *> functions;
+    std::unordered_map<const hir::Function *, std::size_t> indices;
+    for (const auto *function : root) {
+        indices.emplace(function, functions.size());
+        functions.push_back(function);
+    }
+
+    std::vector<std::vector<std::pair<const hir::Function *, std::size_t>>> callees(functions.size());
+    for (std::size_t i = 0; i < functions.size(); i++) {
+        callees[i] = collect_callees(root, *functions[i], profile);
+    }
+
+    // Find the functions reachable from the entry function.
+    std::vector<bool> reachable(functions.size(), false);
+    std::vector<std::size_t> worklist;
+    auto entry_it = std::find_if(functions.begin(), functions.end(), [entry](const hir::Function *function) {
+        return function->name() == entry;
+    });
+    if (entry_it != functions.end()) {
+        worklist.push_back(static_cast<std::size_t>(entry_it - functions.begin()));
+    } else {
+        for (std::size_t i = 0; i < functions.size(); i++) {
+            worklist.push_back(i);
+        }
+    }
+    while (!worklist.empty()) {
+        auto index = worklist.back();
+        worklist.pop_back();
+        if (reachable[index]) {
+            continue;
+        }
+        reachable[index] = true;
+        for (auto [callee, count] : callees[index]) {
+            worklist.push_back(indices.at(callee));
+        }
+    }
+
+    // Lay out the reachable functions with the Pettis-Hansen algorithm. The call graph is treated as undirected, with
+    // each edge weighted by the number of calls between the two functions. Edges are visited from heaviest to
+    // lightest, and the chains containing either end of the edge are merged such that the two ends are as close
+    // together as possible.
+    std::map<std::pair<std::size_t, std::size_t>, std::size_t> edges;
+    for (std::size_t i = 0; i < functions.size(); i++) {
+        if (!reachable[i]) {
+            continue;
+        }
+        for (auto [callee, count] : callees[i]) {
+            auto j = indices.at(callee);
+            if (i != j) {
+                edges[std::minmax(i, j)] += count;
+            }
+        }
+    }
+    std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t>> sorted_edges(edges.begin(), edges.end());
+    std::stable_sort(sorted_edges.begin(), sorted_edges.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second > rhs.second;
+    });
+
+    std::vector<std::vector<std::size_t>> chains(functions.size());
+    std::vector<std::size_t> chain_of(functions.size());
+    std::vector<std::size_t> chain_weight(functions.size(), 0);
+    for (std::size_t i = 0; i < functions.size(); i++) {
+        chains[i].push_back(i);
+        chain_of[i] = i;
+    }
+    for (const auto &[edge, weight] : sorted_edges) {
+        auto [a, b] = edge;
+        auto lhs_chain = chain_of[a];
+        auto rhs_chain = chain_of[b];
+        chain_weight[lhs_chain] += weight;
+        if (lhs_chain == rhs_chain) {
+            continue;
+        }
+        auto &lhs = chains[lhs_chain];
+        auto &rhs = chains[rhs_chain];
+        auto a_pos = static_cast<std::size_t>(std::find(lhs.begin(), lhs.end(), a) - lhs.begin());
+        auto b_pos = static_cast<std::size_t>(std::find(rhs.begin(), rhs.end(), b) - rhs.begin());
+        auto a_from_end = lhs.size() - 1 - a_pos;
+        auto b_from_end = rhs.size() - 1 - b_pos;
+
+        // Pick whichever of the four possible orientations places a and b closest together.
+        auto best = std::min({a_from_end + b_pos, a_from_end + b_from_end, a_pos + b_pos, a_pos + b_from_end});
+        if (best == a_pos + b_pos || best == a_pos + b_from_end) {
+            std::reverse(lhs.begin(), lhs.end());
+        }
+        if (best == a_from_end + b_from_end || best == a_pos + b_from_end) {
+            std::reverse(rhs.begin(), rhs.end());
+        }
+        for (auto index : rhs) {
+            chain_of[index] = lhs_chain;
+        }
+        lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+        rhs.clear();
+        chain_weight[lhs_chain] += chain_weight[rhs_chain];
+    }
+
+    // Place the chain containing the entry function first, followed by the rest from hottest to coldest.
+    std::vector<std::size_t> chain_order;
+    for (std::size_t i = 0; i < functions.size(); i++) {
+        if (!chains[i].empty() && reachable[chains[i].front()]) {
+            chain_order.push_back(i);
+        }
+    }
+    std::stable_sort(chain_order.begin(), chain_order.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return chain_weight[lhs] > chain_weight[rhs];
+    });
+    if (entry_it != functions.end()) {
+        auto entry_chain = chain_of[static_cast<std::size_t>(entry_it - functions.begin())];
+        std::stable_partition(chain_order.begin(), chain_order.end(), [&](std::size_t chain) {
+            return chain == entry_chain;
+        });
+    }
+
+    std::vector<const hir::Function *> ordered;
+    for (auto chain : chain_order) {
+        for (auto index : chains[chain]) {
+            ordered.push_back(functions[index]);
+        }
+    }
+    return ordered;
+}
+
+std::vector<const hir::Function *> reachable_functions(const hir::Root &root, const hir::Function &entry) {
+    std::vector<const hir::Function *> functions{&entry};
+    std::unordered_set<const hir::Function *> visited{&entry};
+    for (std::size_t i = 0; i < functions.size(); i++) {
+        for (auto [callee, count] : collect_callees(root, *functions[i], nullptr)) {
+            if (visited.insert(callee).second) {
+                functions.push_back(callee);
+            }
+        }
+    }
+    return functions;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+class Profile;
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+// Returns the functions reachable from the entry function, ordered so that functions which call each other frequently
+// are placed next to each other. If there is no entry function, every function is treated as reachable. Calls are
+// weighted by the number of call sites, or by how often they were made if a profile is given.
+std::vector<const hir::Function *> order_functions(const hir::Root &root, std::string_view entry,
+                                                   const Profile *profile = nullptr);
+
+// Returns the functions reachable from the entry function, starting with the entry function itself. Unlike
+// order_functions, only the reachable functions are visited.
+std::vector<const hir::Function *> reachable_functions(const hir::Root &root, const hir::Function &entry);
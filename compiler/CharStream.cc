@@ -1,67 +1,180 @@
 #include <CharStream.hh>
 
+#include <Diagnostic.hh>
+
 #include <coel/support/Assert.hh>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <fcntl.h>
 #include <span>
+#include <string_view>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+namespace {
+
+constexpr std::size_t k_chunk_size = 64 * 1024;
+
+} // namespace
+
 FileHandle::~FileHandle() {
     if (m_fd != -1) {
         close(m_fd);
     }
 }
 
-std::pair<FileHandle, CharStream> CharStream::open_file(const char *path) {
+std::optional<std::pair<FileHandle, CharStream>> CharStream::open_file(const char *path) {
     // NOLINTNEXTLINE
-    FileHandle handle(open(path, O_RDONLY));
+    FileHandle handle(std::string_view(path) == "-" ? dup(STDIN_FILENO) : open(path, O_RDONLY));
+    if (handle.fd() == -1) {
+        return std::nullopt;
+    }
     CharStream stream(handle);
-    return {std::move(handle), std::move(stream)};
+    return std::make_pair(std::move(handle), std::move(stream));
 }
 
 CharStream::CharStream(const FileHandle &handle) {
     struct stat stat {};
-    fstat(handle.fd(), &stat);
-    void *data = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, handle.fd(), 0);
-    m_data = {static_cast<char *>(data), static_cast<std::span<char>::size_type>(stat.st_size)};
+    if (fstat(handle.fd(), &stat) == 0 && S_ISREG(stat.st_mode) && stat.st_size > 0) {
+        void *data = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, handle.fd(), 0);
+        if (data != MAP_FAILED) {
+            m_data = {static_cast<char *>(data), static_cast<std::span<char>::size_type>(stat.st_size)};
+            m_mapped = true;
+        }
+    }
+    if (!m_mapped) {
+        // Fall back to reading the input incrementally, e.g. for a pipe.
+        m_fd = handle.fd();
+        m_chunks.push_back({std::make_unique<char[]>(k_chunk_size), 0, 0, k_chunk_size});
+        select_chunk(0);
+    }
+    enter_line();
 }
 
+CharStream::CharStream(CharStream &&other) noexcept
+    : m_data(std::exchange(other.m_data, {})), m_base(other.m_base), m_position(other.m_position),
+      m_line_start(other.m_line_start), m_line_end(other.m_line_end), m_line(other.m_line), m_column(other.m_column),
+      m_mapped(std::exchange(other.m_mapped, false)), m_fd(std::exchange(other.m_fd, -1)),
+      m_chunks(std::move(other.m_chunks)), m_chunk(other.m_chunk) {}
+
 CharStream::~CharStream() {
-    if (!m_data.empty()) {
+    if (m_mapped) {
         munmap(m_data.data(), m_data.size_bytes());
     }
 }
 
+void CharStream::select_chunk(std::size_t index) {
+    const auto &chunk = m_chunks[index];
+    m_chunk = index;
+    m_data = {chunk.data.get(), chunk.size};
+    m_base = chunk.base;
+}
+
+void CharStream::load_line() {
+    // The previous line may have ended at the end of its chunk, in which case this line starts the next one.
+    if (m_position == m_data.size() && m_chunk + 1 < m_chunks.size()) {
+        select_chunk(m_chunk + 1);
+        m_position = 0;
+    }
+    auto scanned = m_position;
+    while (m_fd != -1 && std::memchr(m_data.data() + scanned, '\n', m_data.size() - scanned) == nullptr) {
+        scanned = m_data.size();
+        if (m_chunks[m_chunk].size == m_chunks[m_chunk].capacity) {
+            // The line doesn't fit in the rest of the chunk, so move what has been loaded of it to a new chunk. None of
+            // the line has been read yet, so nothing can be referring to it. If the line is all the chunk holds, the
+            // chunk is replaced outright.
+            const auto length = m_data.size() - m_position;
+            const auto capacity = std::max(k_chunk_size, length * 2);
+            Chunk chunk{std::make_unique<char[]>(capacity), m_base + m_position, length, capacity};
+            std::memcpy(chunk.data.get(), m_data.data() + m_position, length);
+            if (m_position == 0) {
+                m_chunks[m_chunk] = std::move(chunk);
+            } else {
+                m_chunks[m_chunk].size = m_position;
+                m_chunks.push_back(std::move(chunk));
+            }
+            select_chunk(m_position == 0 ? m_chunk : m_chunks.size() - 1);
+            m_position = 0;
+            scanned = length;
+        }
+
+        auto &chunk = m_chunks[m_chunk];
+        auto bytes = read(m_fd, chunk.data.get() + chunk.size, chunk.capacity - chunk.size);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            Diagnostic(SourceLocation(m_line, m_column, {}), "failed to read input: {}", std::strerror(errno));
+        }
+        if (bytes == 0) {
+            m_fd = -1;
+        }
+        chunk.size += static_cast<std::size_t>(bytes);
+        m_data = {chunk.data.get(), chunk.size};
+    }
+}
+
+void CharStream::find_line_end() {
+    const auto *end = std::memchr(m_data.data() + m_line_start, '\n', m_data.size() - m_line_start);
+    m_line_end = end != nullptr ? static_cast<std::size_t>(static_cast<const char *>(end) - m_data.data())
+                                : m_data.size();
+}
+
+void CharStream::enter_line() {
+    if (!m_mapped) {
+        load_line();
+    }
+    m_line_start = m_position;
+    find_line_end();
+}
+
 bool CharStream::has_next() {
-    return m_position != m_data.size_bytes();
+    return m_position != m_data.size();
 }
 
 char CharStream::peek() {
-    return m_data[m_position];
+    return has_next() ? m_data[m_position] : '\0';
 }
 
 char CharStream::next() {
     COEL_ASSERT(has_next());
-    if (m_data[m_position] == '\n') {
-        m_line_start = m_position + 1;
+    const char ch = m_data[m_position++];
+    if (ch == '\n') {
         m_line++;
         m_column = 1;
+        enter_line();
     } else {
         m_column++;
     }
-    return m_data[m_position++];
+    return ch;
 }
 
-SourceLocation CharStream::location() const {
-    std::size_t line_length = 0;
-    for (std::size_t i = m_line_start; m_data[i] != '\0' && m_data[i] != '\n'; i++, line_length++) {
+void CharStream::seek(const Position &position) {
+    if (!m_mapped) {
+        // Find the chunk containing the position. Since lines never cross chunks, that is the last chunk starting at or
+        // before the line start.
+        auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), position.line_start,
+                                   [](std::size_t offset, const Chunk &chunk) {
+                                       return offset < chunk.base;
+                                   });
+        select_chunk(static_cast<std::size_t>(it - m_chunks.begin()) - 1);
     }
-    return {m_line, m_column, {&m_data[m_line_start], line_length}};
+    COEL_ASSERT(position.offset - m_base <= m_data.size());
+    m_position = position.offset - m_base;
+    m_line_start = position.line_start - m_base;
+    m_line = position.line;
+    m_column = position.column;
+    find_line_end();
+}
+
+SourceLocation CharStream::location() const {
+    return {m_line, m_column, {m_data.data() + m_line_start, m_line_end - m_line_start}};
 }
 
 char *CharStream::position_ptr() const {
-    return &m_data[m_position];
+    return m_data.data() + m_position;
 }
@@ -3,8 +3,11 @@
 #include <SourceLocation.hh>
 
 #include <cstddef>
+#include <memory>
+#include <optional>
 #include <span>
 #include <utility>
+#include <vector>
 
 class FileHandle {
     int m_fd;
@@ -21,19 +24,53 @@ public:
     int fd() const { return m_fd; }
 };
 
+// A stream of characters from a file. Regular files are mapped into memory, whereas pipes, sockets and terminals are
+// read incrementally into a list of chunks. Chunks are never freed or moved, and a line is always loaded in full into a
+// single chunk before any of it is read, so views into the input, such as identifiers and source lines, stay valid for
+// the lifetime of the stream.
 class CharStream {
+public:
+    // A saved read position which can be returned to with seek. Offsets are from the start of the input.
+    struct Position {
+        std::size_t offset;
+        std::size_t line_start;
+        std::size_t line;
+        std::size_t column;
+    };
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        std::size_t base;
+        std::size_t size;
+        std::size_t capacity;
+    };
+
+    // The chunk currently being read from, or the whole file if it is mapped.
     std::span<char> m_data;
+    std::size_t m_base{0};
     std::size_t m_position{0};
     std::size_t m_line_start{0};
+    std::size_t m_line_end{0};
     std::size_t m_line{1};
     std::size_t m_column{1};
+    bool m_mapped{false};
+    int m_fd{-1};
+    std::vector<Chunk> m_chunks;
+    std::size_t m_chunk{0};
+
+    void select_chunk(std::size_t index);
+    void load_line();
+    void find_line_end();
+    void enter_line();
 
 public:
-    static std::pair<FileHandle, CharStream> open_file(const char *path);
+    // Opens a file, or standard input if path is "-".
+    static std::optional<std::pair<FileHandle, CharStream>> open_file(const char *path);
 
     explicit CharStream(const FileHandle &handle);
     CharStream(const CharStream &) = delete;
-    CharStream(CharStream &&other) noexcept : m_data(other.m_data), m_position(other.m_position) { other.m_data = {}; }
+    CharStream(CharStream &&other) noexcept;
     ~CharStream();
 
     CharStream &operator=(const CharStream &) = delete;
@@ -42,7 +79,9 @@ public:
     bool has_next();
     char peek();
     char next();
+    void seek(const Position &position);
 
     SourceLocation location() const;
+    Position position() const { return {m_base + m_position, m_base + m_line_start, m_line, m_column}; }
     char *position_ptr() const;
 };
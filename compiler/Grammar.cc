@@ -0,0 +1,65 @@
+#include <Grammar.hh>
+
+#include <Diagnostic.hh>
+
+namespace {
+
+constexpr int precedence(Operator op) {
+    switch (op) {
+    case Operator::Add:
+    case Operator::Sub:
+        return 1;
+    }
+}
+
+} // namespace
+
+std::optional<Token> consume(Lexer &lexer, TokenKind kind) {
+    if (lexer.peek().kind() == kind) {
+        return lexer.next();
+    }
+    return std::nullopt;
+}
+
+Token expect(Lexer &lexer, TokenKind kind) {
+    auto next = lexer.next();
+    if (next.kind() != kind) {
+        Diagnostic(lexer.location(), "expected {} but got {}", Token::kind_string(kind), next.to_string());
+    }
+    return next;
+}
+
+std::optional<Operator> binary_operator(TokenKind kind) {
+    switch (kind) {
+    case TokenKind::Plus:
+        return Operator::Add;
+    case TokenKind::Minus:
+        return Operator::Sub;
+    default:
+        return std::nullopt;
+    }
+}
+
+int compare_op(Operator op1, Operator op2) {
+    int p1 = precedence(op1);
+    int p2 = precedence(op2);
+    return p1 > p2 ? 1 : p1 < p2 ? -1 : 0;
+}
+
+std::optional<std::size_t> parse_range_last(Lexer &lexer, const SourceLocation &first_location,
+                                            std::optional<std::size_t> first_value) {
+    const auto kind = lexer.peek().kind();
+    if (kind != TokenKind::DotDot && kind != TokenKind::DotDotEq) {
+        return std::nullopt;
+    }
+    lexer.next();
+    if (!first_value) {
+        Diagnostic(first_location, "range pattern must start with an integer literal");
+    }
+    const auto end = expect(lexer, TokenKind::IntLit).number();
+    const bool inclusive = kind == TokenKind::DotDotEq;
+    if (inclusive ? end < *first_value : end <= *first_value) {
+        Diagnostic(first_location, "empty range pattern");
+    }
+    return inclusive ? end : end - 1;
+}
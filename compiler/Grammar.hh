@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Diagnostic.hh>
+#include <Lexer.hh>
+#include <SourceLocation.hh>
+#include <Token.hh>
+
+#include <coel/support/Assert.hh>
+#include <coel/support/Stack.hh>
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+// The parts of the expression grammar shared by the AST parser and the HIR parser, so that the two accept the same
+// language and only differ in the nodes they build.
+
+enum class Operator {
+    Add,
+    Sub,
+};
+
+std::optional<Token> consume(Lexer &lexer, TokenKind kind);
+Token expect(Lexer &lexer, TokenKind kind);
+
+// Returns the binary operator a token stands for, if any.
+std::optional<Operator> binary_operator(TokenKind kind);
+
+// Returns whether op1 binds tighter (1), looser (-1) or the same (0) as op2.
+int compare_op(Operator op1, Operator op2);
+
+// Parses the end of a range pattern, if there is one, and returns its inclusive last value. first_value is the value of
+// the integer literal the pattern starts with, or std::nullopt if it starts with some other expression.
+std::optional<std::size_t> parse_range_last(Lexer &lexer, const SourceLocation &first_location,
+                                            std::optional<std::size_t> first_value);
+
+// Parses a chain of operands and binary operators with the shunting-yard algorithm. parse_operand parses the operand
+// starting at the next token, returning std::nullopt if the token can't start one, and create_binary builds a binary
+// expression from an operator and its two operands.
+template <typename Node, typename ParseOperand, typename CreateBinary>
+Node parse_binary_expr(Lexer &lexer, ParseOperand &&parse_operand, CreateBinary &&create_binary) {
+    coel::Stack<Node> operands;
+    coel::Stack<Operator> operators;
+    auto reduce = [&](Operator op) {
+        auto rhs = operands.pop();
+        auto lhs = operands.pop();
+        operands.push(create_binary(lexer.location(), op, std::move(lhs), std::move(rhs)));
+    };
+    while (true) {
+        auto op1 = binary_operator(lexer.peek().kind());
+        if (!op1) {
+            std::optional<Node> operand = parse_operand();
+            if (!operand) {
+                break;
+            }
+            operands.push(std::move(*operand));
+            continue;
+        }
+        lexer.next();
+        while (!operators.empty() && compare_op(*op1, operators.peek()) < 0) {
+            reduce(operators.pop());
+        }
+        operators.push(*op1);
+    }
+    while (!operators.empty()) {
+        auto op = operators.pop();
+        if (operands.size() < 2) {
+            const auto &actual = lexer.peek();
+            Diagnostic(lexer.location(), "expected expression before {} token", actual.to_string());
+        }
+        reduce(op);
+    }
+    COEL_ASSERT(operands.size() == 1);
+    return operands.pop();
+}
@@ -6,12 +6,18 @@
 #include <coel/support/List.hh>
 #include <coel/support/ListNode.hh>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
 #include <vector>
 
 namespace hir {
 
 class Function;
+class Root;
 struct Visitor;
 
 enum class TypeKind {
@@ -48,15 +54,12 @@ public:
     }
 };
 
-class Stmt : public coel::ListNode {
-public:
-    virtual void accept(Visitor *visitor) const = 0;
-};
-
 enum class ExprKind {
     // Binary
     Add,
     Sub,
+    // A range pattern, whose operands are constants holding its first and last values.
+    Range,
 
     Argument,
     Block,
@@ -64,120 +67,122 @@ enum class ExprKind {
     Constant,
     Match,
     Var,
+    // The pattern of a default match arm, which matches any value.
+    Wildcard,
 };
 
 using ExprId = std::size_t;
 
-class Expr {
-    union {
-        struct {
-            std::size_t index{0};
-        } m_argument;
-        struct {
-            ExprId lhs{0};
-            ExprId rhs{0};
-        } m_binary;
-        struct {
-            coel::List<Stmt> *stmts{nullptr};
-        } m_block;
-        struct {
-            const Function *callee{nullptr};
-            const ExprId *args{nullptr};
-        } m_call;
-        struct {
-            std::size_t value{0};
-        } m_constant;
-        struct {
-            ExprId matchee{0};
-            const std::pair<ExprId, ExprId> *arms{nullptr};
-            std::size_t arm_count;
-        } m_match;
-    };
-    SourceLocation m_location;
-    Type m_type{TypeKind::Infer};
-    ExprKind m_kind;
+// An (offset, length) slice of one of the side pools owned by Root.
+struct PoolRange {
+    std::uint32_t offset;
+    std::uint32_t length;
+};
 
-public:
-    Expr(const SourceLocation &location, ExprKind kind, Type type) : m_location(location), m_kind(kind), m_type(type) {
-        if (kind == ExprKind::Block) {
-            m_block.stmts = new coel::List<Stmt>;
-        }
-    }
-    Expr(const SourceLocation &location, ExprKind kind, Type type, std::size_t value)
-        : m_location(location), m_kind(kind), m_type(type), m_argument{value} {}
-    Expr(const SourceLocation &location, ExprKind op, ExprId lhs, ExprId rhs)
-        : m_location(location), m_kind(op), m_binary{lhs, rhs} {}
-    Expr(const SourceLocation &location, const Function *callee, Type type, const ExprId *args)
-        : m_location(location), m_kind(ExprKind::Call), m_type(type), m_call{callee, args} {}
-    Expr(const SourceLocation &location, ExprKind kind, std::size_t value)
-        : m_location(location), m_kind(kind), m_constant{value} {}
-    Expr(const SourceLocation &location, ExprId matchee, const std::pair<ExprId, ExprId> *arms, std::size_t arm_count)
-        : m_location(location), m_kind(ExprKind::Match), m_match{matchee, arms, arm_count} {}
-    Expr(const Expr &) = delete;
-    Expr(Expr &&other) noexcept
-        : m_location(other.m_location), m_type(other.m_type), m_kind(other.m_kind), m_binary(other.m_binary) {
-        if (m_kind == ExprKind::Block) {
-            other.m_block.stmts = nullptr;
-        } else if (m_kind == ExprKind::Call) {
-            other.m_call.args = nullptr;
-        } else if (m_kind == ExprKind::Match) {
-            other.m_match.arms = nullptr;
-        }
-    }
-    ~Expr() {
-        if (m_kind == ExprKind::Block) {
-            delete m_block.stmts;
-        } else if (m_kind == ExprKind::Call) {
-            delete[] m_call.args;
-        } else if (m_kind == ExprKind::Match) {
-            delete[] m_match.arms;
-        }
-    }
+// The kind-specific part of an expression. Any variable-length payload (block statements, call arguments and match
+// arms) lives in a pool owned by Root and is referenced by range.
+union ExprPayload {
+    struct {
+        std::size_t index;
+    } argument;
+    struct {
+        ExprId lhs;
+        ExprId rhs;
+    } binary;
+    struct {
+        PoolRange stmts;
+        std::uint32_t capacity;
+        bool has_value;
+        ExprId value;
+    } block;
+    struct {
+        const Function *callee;
+        PoolRange args;
+    } call;
+    struct {
+        std::size_t value;
+    } constant;
+    struct {
+        ExprId matchee;
+        PoolRange arms;
+        bool exhaustive;
+        std::uint32_t hot_arm_count;
+    } match;
+};
+
+// A read-only view of an expression stored in Root. Views are indices, so they stay valid as expressions are created.
+class Expr {
+    const Root *m_root;
+    ExprId m_id;
 
-    Expr &operator=(const Expr &) = delete;
-    Expr &operator=(Expr &&) = delete;
+    const ExprPayload &payload() const;
 
-    template <typename T, typename... Args>
-    void append(Args &&...args) {
-        COEL_ASSERT(m_kind == ExprKind::Block);
-        m_block.stmts->emplace<T>(m_block.stmts->end(), std::forward<Args>(args)...);
+public:
+    Expr(const Root *root, ExprId id) : m_root(root), m_id(id) {}
+
+    const SourceLocation &location() const;
+    const Type &type() const;
+    ExprKind kind() const;
+    std::size_t argument_index() const { return payload().argument.index; }
+    ExprId binary_lhs() const { return payload().binary.lhs; }
+    ExprId binary_rhs() const { return payload().binary.rhs; }
+    std::optional<ExprId> block_value() const {
+        const auto &block = payload().block;
+        return block.has_value ? std::make_optional(block.value) : std::nullopt;
     }
-    void set_type(Type type) {
-        // TODO: Should probably be asserts.
-        if (m_kind == ExprKind::Argument || m_kind == ExprKind::Call) {
-            return;
-        }
-        m_type = type;
-    }
-
-    const SourceLocation &location() const { return m_location; }
-    const Type &type() const { return m_type; }
-    ExprKind kind() const { return m_kind; }
-    std::size_t argument_index() const { return m_argument.index; }
-    ExprId binary_lhs() const { return m_binary.lhs; }
-    ExprId binary_rhs() const { return m_binary.rhs; }
-    const coel::List<Stmt> &block_stmts() const { return *m_block.stmts; }
-    const Function *call_callee() const { return m_call.callee; }
-    const ExprId *call_args() const { return m_call.args; }
-    std::size_t constant_value() const { return m_constant.value; }
-    ExprId match_matchee() const { return m_match.matchee; }
-    const std::pair<ExprId, ExprId> *match_arms() const { return m_match.arms; }
-    std::size_t match_arm_count() const { return m_match.arm_count; }
+    const Function *call_callee() const { return payload().call.callee; }
+    std::size_t constant_value() const { return payload().constant.value; }
+    ExprId match_matchee() const { return payload().match.matchee; }
+    std::size_t match_arm_count() const { return payload().match.arms.length; }
+    // Whether one of the arms is always taken, in which case the last arm needn't be tested.
+    bool match_exhaustive() const { return payload().match.exhaustive; }
+    // The number of leading arms which are taken often enough that they should be tested first, one at a time.
+    std::size_t match_hot_arm_count() const { return payload().match.hot_arm_count; }
 };
 
-class DeclStmt final : public Stmt {
-    const ExprId m_var;
-    const ExprId m_value;
+class DeclStmt {
+    ExprId m_var;
+    ExprId m_value;
 
 public:
     DeclStmt(ExprId var, ExprId value) : m_var(var), m_value(value) {}
 
-    void accept(Visitor *visitor) const override;
-
     ExprId var() const { return m_var; }
     ExprId value() const { return m_value; }
 };
 
+class ReturnStmt {
+    ExprId m_value;
+
+public:
+    explicit ReturnStmt(ExprId value) : m_value(value) {}
+
+    ExprId value() const { return m_value; }
+};
+
+enum class StmtKind {
+    Decl,
+    Return,
+};
+
+// A statement stored by value in Root's statement pool.
+class Stmt {
+    union {
+        DeclStmt m_decl;
+        ReturnStmt m_return;
+    };
+    StmtKind m_kind;
+
+public:
+    Stmt() : m_return(0), m_kind(StmtKind::Return) {}
+    Stmt(const DeclStmt &decl) : m_decl(decl), m_kind(StmtKind::Decl) {}
+    Stmt(const ReturnStmt &ret) : m_return(ret), m_kind(StmtKind::Return) {}
+
+    void accept(Visitor *visitor) const;
+
+    StmtKind kind() const { return m_kind; }
+};
+
 class Function final : public coel::ListNode {
     const std::string m_name;
     const std::vector<ExprId> m_params;
@@ -194,56 +199,238 @@ public:
     ExprId block() const { return m_block; }
 };
 
-class ReturnStmt final : public Stmt {
-    const ExprId m_value;
-
-public:
-    explicit ReturnStmt(ExprId value) : m_value(value) {}
-
-    void accept(Visitor *visitor) const override;
-
-    ExprId value() const { return m_value; }
-};
-
+// Expressions are stored as a structure of arrays indexed by ExprId. Kinds and payloads, which every pass reads, are
+// kept apart from types and source locations, which are only needed by analysis and diagnostics.
 class Root {
+    friend Expr;
+
     coel::List<Function> m_functions;
-    std::vector<Expr> m_exprs;
+    std::vector<ExprKind> m_kinds;
+    std::vector<ExprPayload> m_payloads;
+    std::vector<Type> m_types;
+    std::vector<SourceLocation> m_locations;
+    std::vector<Stmt> m_stmts;
+    std::vector<ExprId> m_args;
+    std::vector<std::pair<ExprId, ExprId>> m_arms;
+
+    template <typename T>
+    static PoolRange append_range(std::vector<T> &pool, std::span<const T> elements) {
+        // elements may alias the pool, so copy by index after growing it.
+        const auto offset = pool.size();
+        const auto source = elements.data() >= pool.data() && elements.data() < pool.data() + pool.size()
+                                ? std::make_optional(static_cast<std::size_t>(elements.data() - pool.data()))
+                                : std::nullopt;
+        if (source) {
+            pool.resize(offset + elements.size());
+            std::copy_n(pool.begin() + static_cast<std::ptrdiff_t>(*source), elements.size(),
+                        pool.begin() + static_cast<std::ptrdiff_t>(offset));
+        } else {
+            pool.insert(pool.end(), elements.begin(), elements.end());
+        }
+        return {static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(elements.size())};
+    }
+
+    ExprId push_expr(const SourceLocation &location, ExprKind kind, Type type, const ExprPayload &payload) {
+        m_kinds.push_back(kind);
+        m_payloads.push_back(payload);
+        m_types.push_back(type);
+        m_locations.push_back(location);
+        return m_kinds.size() - 1;
+    }
 
 public:
+    // The sizes of the expression and payload pools at some point, which the pools can later be truncated back to.
+    struct Watermark {
+        std::size_t expr_count;
+        std::size_t stmt_count;
+        std::size_t arg_count;
+        std::size_t arm_count;
+    };
+
     Function *append_function(std::string name, std::vector<ExprId> &&params) {
         return m_functions.emplace<Function>(m_functions.end(), std::move(name), std::move(params));
     }
 
-    template <typename... Args>
-    ExprId create_expr(Args &&...args) {
-        m_exprs.emplace_back(std::forward<Args>(args)...);
-        return m_exprs.size() - 1;
+    ExprId create_expr(const SourceLocation &location, ExprKind kind, Type type) {
+        return push_expr(location, kind, type, {.block{{0, 0}, 0, false, 0}});
+    }
+    ExprId create_expr(const SourceLocation &location, ExprKind kind, Type type, std::size_t index) {
+        return push_expr(location, kind, type, {.argument{index}});
+    }
+    ExprId create_expr(const SourceLocation &location, ExprKind op, ExprId lhs, ExprId rhs) {
+        return push_expr(location, op, TypeKind::Infer, {.binary{lhs, rhs}});
+    }
+    ExprId create_expr(const SourceLocation &location, ExprKind kind, std::size_t value) {
+        return push_expr(location, kind, TypeKind::Infer, {.constant{value}});
+    }
+    ExprId create_call(const SourceLocation &location, const Function *callee, Type type,
+                       std::span<const ExprId> args) {
+        return push_expr(location, ExprKind::Call, type, {.call{callee, append_range(m_args, args)}});
+    }
+    ExprId create_match(const SourceLocation &location, ExprId matchee, std::span<const std::pair<ExprId, ExprId>> arms,
+                        bool exhaustive = false, std::size_t hot_arm_count = 0) {
+        const auto hot = static_cast<std::uint32_t>(std::min(hot_arm_count, arms.size()));
+        return push_expr(location, ExprKind::Match, TypeKind::Infer,
+                         {.match{matchee, append_range(m_arms, arms), exhaustive, hot}});
+    }
+
+    // Replaces the expression at id with a copy of the expression at other, keeping any references to id valid.
+    void replace_expr(ExprId id, ExprId other) {
+        m_kinds[id] = m_kinds[other];
+        m_payloads[id] = m_payloads[other];
+        m_types[id] = m_types[other];
+        m_locations[id] = m_locations[other];
+    }
+
+    void set_type(ExprId id, Type type) {
+        // TODO: Should probably be asserts.
+        if (m_kinds[id] == ExprKind::Argument || m_kinds[id] == ExprKind::Call) {
+            return;
+        }
+        m_types[id] = type;
+    }
+    // Points a call at its callee, taking on the callee's return type. Used for calls parsed before their callee.
+    void resolve_call(ExprId call, const Function *callee) {
+        COEL_ASSERT(m_kinds[call] == ExprKind::Call);
+        m_payloads[call].call.callee = callee;
+        m_types[call] = m_types[callee->block()];
+    }
+    void set_block_value(ExprId block, ExprId value) {
+        COEL_ASSERT(m_kinds[block] == ExprKind::Block);
+        m_payloads[block].block.value = value;
+        m_payloads[block].block.has_value = true;
+    }
+
+    // Overwrites the arms of a match in place with the same number of arms, e.g. to reorder them.
+    void set_match_arms(ExprId match, std::span<const std::pair<ExprId, ExprId>> arms) {
+        const auto &range = m_payloads[match].match.arms;
+        COEL_ASSERT(m_kinds[match] == ExprKind::Match && range.length == arms.size());
+        std::copy(arms.begin(), arms.end(), m_arms.begin() + range.offset);
+    }
+
+    // Marks a match as exhaustive, dropping any arms after the first arm_count, which can never be reached.
+    void set_match_exhaustive(ExprId match, std::size_t arm_count) {
+        auto &match_payload = m_payloads[match].match;
+        COEL_ASSERT(m_kinds[match] == ExprKind::Match && arm_count <= match_payload.arms.length);
+        match_payload.arms.length = static_cast<std::uint32_t>(arm_count);
+        match_payload.exhaustive = true;
+        match_payload.hot_arm_count = std::min(match_payload.hot_arm_count, match_payload.arms.length);
+    }
+    void set_match_hot_arm_count(ExprId match, std::size_t hot_arm_count) {
+        auto &match_payload = m_payloads[match].match;
+        COEL_ASSERT(m_kinds[match] == ExprKind::Match && hot_arm_count <= match_payload.arms.length);
+        match_payload.hot_arm_count = static_cast<std::uint32_t>(hot_arm_count);
+    }
+
+    // Empties a block, e.g. before rebuilding a body whose statements were discarded by truncate.
+    void reset_block(ExprId block) {
+        COEL_ASSERT(m_kinds[block] == ExprKind::Block);
+        m_payloads[block].block = {{0, 0}, 0, false, 0};
+    }
+
+    // Discards every expression, statement, argument and match arm created since the watermark was taken. Pool capacity
+    // is kept for reuse.
+    void truncate(const Watermark &watermark) {
+        m_kinds.resize(watermark.expr_count);
+        m_payloads.resize(watermark.expr_count);
+        m_types.resize(watermark.expr_count, TypeKind::Infer);
+        m_locations.resize(watermark.expr_count, SourceLocation(0, 0, {}));
+        m_stmts.resize(watermark.stmt_count);
+        m_args.resize(watermark.arg_count);
+        m_arms.resize(watermark.arm_count);
+    }
+
+    // Appends a statement to a block. A block's statements are kept contiguous, so a block which isn't at the end of
+    // the pool is moved there, with room to grow, once it runs out of capacity.
+    void append_stmt(ExprId block, const Stmt &stmt) {
+        auto &range = m_payloads[block].block;
+        if (range.stmts.length == range.capacity) {
+            const auto capacity = std::max(range.capacity * 2, 4u);
+            if (range.stmts.offset + range.capacity != m_stmts.size()) {
+                const auto offset = m_stmts.size();
+                m_stmts.resize(offset + capacity);
+                std::copy_n(m_stmts.begin() + range.stmts.offset, range.stmts.length, m_stmts.begin() + offset);
+                range.stmts.offset = static_cast<std::uint32_t>(offset);
+            } else {
+                m_stmts.resize(range.stmts.offset + capacity);
+            }
+            range.capacity = capacity;
+        }
+        m_stmts[range.stmts.offset + range.stmts.length++] = stmt;
     }
 
     auto begin() const { return m_functions.begin(); }
     auto end() const { return m_functions.end(); }
-    Expr &expr(ExprId id) { return m_exprs[id]; }
-    const Expr &expr(ExprId id) const { return m_exprs[id]; }
-    const Type &type(ExprId id) const { return m_exprs[id].type(); }
-    std::size_t expr_count() const { return m_exprs.size(); }
+    Expr expr(ExprId id) const { return {this, id}; }
+    ExprKind kind(ExprId id) const { return m_kinds[id]; }
+    const Type &type(ExprId id) const { return m_types[id]; }
+    const SourceLocation &location(ExprId id) const { return m_locations[id]; }
+    std::size_t expr_count() const { return m_kinds.size(); }
+    Watermark watermark() const { return {m_kinds.size(), m_stmts.size(), m_args.size(), m_arms.size()}; }
+
+    // The returned spans are invalidated by creating any new statements, calls or matches respectively.
+    std::span<const Stmt> block_stmts(ExprId id) const {
+        const auto &range = m_payloads[id].block.stmts;
+        return {m_stmts.data() + range.offset, range.length};
+    }
+    std::span<const ExprId> call_args(ExprId id) const {
+        const auto &range = m_payloads[id].call.args;
+        return {m_args.data() + range.offset, range.length};
+    }
+    std::span<const std::pair<ExprId, ExprId>> match_arms(ExprId id) const {
+        const auto &range = m_payloads[id].match.arms;
+        return {m_arms.data() + range.offset, range.length};
+    }
+
+    // Returns the first and last values matched by a constant or range pattern.
+    std::optional<std::pair<std::size_t, std::size_t>> pattern_values(ExprId id) const {
+        switch (m_kinds[id]) {
+        case ExprKind::Constant:
+            return std::make_pair(m_payloads[id].constant.value, m_payloads[id].constant.value);
+        case ExprKind::Range:
+            return std::make_pair(m_payloads[m_payloads[id].binary.lhs].constant.value,
+                                  m_payloads[m_payloads[id].binary.rhs].constant.value);
+        default:
+            return std::nullopt;
+        }
+    }
 };
 
+inline const ExprPayload &Expr::payload() const {
+    return m_root->m_payloads[m_id];
+}
+
+inline const SourceLocation &Expr::location() const {
+    return m_root->m_locations[m_id];
+}
+
+inline const Type &Expr::type() const {
+    return m_root->m_types[m_id];
+}
+
+inline ExprKind Expr::kind() const {
+    return m_root->m_kinds[m_id];
+}
+
 struct Visitor {
     virtual void visit(const DeclStmt &decl_stmt) = 0;
     virtual void visit(const Function &function) = 0;
     virtual void visit(const ReturnStmt &return_stmt) = 0;
 };
 
-inline void DeclStmt::accept(Visitor *visitor) const {
-    visitor->visit(*this);
-}
-
 inline void Function::accept(Visitor *visitor) const {
     visitor->visit(*this);
 }
 
-inline void ReturnStmt::accept(Visitor *visitor) const {
-    visitor->visit(*this);
+inline void Stmt::accept(Visitor *visitor) const {
+    switch (m_kind) {
+    case StmtKind::Decl:
+        visitor->visit(m_decl);
+        break;
+    case StmtKind::Return:
+        visitor->visit(m_return);
+        break;
+    }
 }
 
 } // namespace hir
@@ -3,33 +3,163 @@
 #include <Hir.hh>
 
 #include <coel/ir/Constant.hh>
+#include <coel/ir/Types.hh>
 
+#include <algorithm>
+#include <cstddef>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace {
 
+// Collects the callees of calls in tail position, i.e. calls whose result is returned directly.
+class TailCallCollector final : public hir::Visitor {
+    const hir::Root &m_root;
+    std::vector<const hir::Function *> m_callees;
+
+    void collect(hir::ExprId id);
+
+public:
+    explicit TailCallCollector(const hir::Root &root) : m_root(root) {}
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+
+    const std::vector<const hir::Function *> &callees() const { return m_callees; }
+};
+
+// Finds the strongly connected components of the tail call graph. The bodies of the functions in a recursive component
+// are lowered together so that tail calls within it can be lowered to jumps. The members of each component are given
+// in the same order as the functions were.
+class TailGroupFinder {
+    std::unordered_map<const hir::Function *, std::vector<const hir::Function *>> m_edges;
+    std::unordered_map<const hir::Function *, std::pair<std::size_t, std::size_t>> m_indices;
+    std::unordered_map<const hir::Function *, std::size_t> m_positions;
+    std::vector<const hir::Function *> m_stack;
+    std::unordered_map<const hir::Function *, bool> m_on_stack;
+    std::vector<std::vector<const hir::Function *>> m_groups;
+
+    void connect(const hir::Function *function);
+
+public:
+    TailGroupFinder(const hir::Root &root, const std::vector<const hir::Function *> &functions);
+
+    std::vector<std::vector<const hir::Function *>> &groups() { return m_groups; }
+};
+
+// A recursive component of the tail call graph. A group of more than one function has the bodies of all of its members
+// lowered once into a shared function, which takes the index of the member to enter followed by the parameters of
+// every member. The members themselves are lowered to stubs which call the shared function.
+struct TailGroup {
+    std::vector<const hir::Function *> members;
+    coel::ir::Function *shared{nullptr};
+};
+
+struct TailEntry {
+    coel::ir::BasicBlock *header;
+    std::vector<coel::ir::Value *> params;
+};
+
+enum class TaskKind {
+    // Lower an expression and push its value.
+    Expr,
+    // Lower an expression in tail position, i.e. return its value.
+    Tail,
+    // Lower the statement at index of a block.
+    Stmt,
+    Binary,
+    Call,
+    Decl,
+    MatchArm,
+    MatchCompare,
+    MatchStore,
+    Ret,
+    TailCall,
+    TailMatchArm,
+    TailMatchCompare,
+    TailMatchNext,
+};
+
+// A unit of pending lowering work. Expressions are lowered with an explicit stack of tasks rather than by recursion, so
+// that deeply nested expressions can't overflow the native stack. Any operand values are passed on a value stack.
+struct Task {
+    TaskKind kind;
+    hir::ExprId id{0};
+    std::size_t index{0};
+};
+
+// The state of a match whose arms are being lowered. The runs of arms to dispatch to by a binary search, as the index
+// of their first arm and their length, are found when the frame is pushed. While a run is being lowered, each arm in
+// it has its own block, and false_dst is the block reached if none of them match.
+struct MatchFrame {
+    coel::ir::Value *matchee;
+    coel::ir::Value *result_var{nullptr};
+    coel::ir::BasicBlock *false_dst{nullptr};
+    std::vector<coel::ir::BasicBlock *> blocks;
+    std::vector<std::pair<std::size_t, std::size_t>> search_runs;
+    std::size_t next_search_run{0};
+    std::size_t search_begin{0};
+    std::vector<coel::ir::BasicBlock *> search_blocks;
+};
+
+// The type of the argument which selects the member of a tail group to enter.
+const coel::ir::Type *selector_type() {
+    return coel::ir::IntegerType::get(32);
+}
+
+// A run needs at least this many arms to be lowered to a binary search rather than to a chain of tests.
+constexpr std::size_t k_min_search_arms = 4;
+
 class HirLowering final : public hir::Visitor {
     const hir::Root &m_root;
+    std::vector<TailGroup> m_tail_groups;
+    std::unordered_map<const hir::Function *, std::size_t> m_tail_group_indices;
     coel::ir::Unit m_unit;
     coel::ir::Function *m_function{nullptr};
+    const hir::Function *m_hir_function{nullptr};
     coel::ir::BasicBlock *m_block{nullptr};
     std::unordered_map<const hir::Function *, coel::ir::Function *> m_function_map;
+    std::unordered_map<const hir::Function *, TailEntry> m_tail_entries;
     std::unordered_map<hir::ExprId, coel::ir::Value *> m_vars;
+    std::vector<Task> m_tasks;
+    std::vector<coel::ir::Value *> m_values;
+    std::vector<MatchFrame> m_match_frames;
 
+    void push_stmts(hir::ExprId block);
+    coel::ir::Value *pop_value();
+    bool is_unconditional_arm(hir::ExprId id, std::size_t index) const;
+    std::vector<std::pair<std::size_t, std::size_t>> find_search_runs(hir::ExprId id) const;
+    std::size_t take_search_run(std::size_t index);
+    bool advance_match_arm(std::size_t index);
     coel::ir::Value *lower_argument(std::size_t index);
-    coel::ir::Value *lower_binary(hir::ExprKind op, hir::ExprId lhs_id, hir::ExprId rhs_id);
-    coel::ir::Value *lower_block(const coel::List<hir::Stmt> &stmts);
-    coel::ir::Value *lower_call(const hir::Function *callee, const hir::ExprId *arg_ids);
-    coel::ir::Value *lower_constant(const hir::Type &type, std::size_t value);
-    coel::ir::Value *lower_match(const hir::Type &type, hir::ExprId matchee_id,
-                                 const std::pair<hir::ExprId, hir::ExprId> *arms, std::size_t arm_count);
-    coel::ir::Value *lower_var(hir::ExprId id);
-    coel::ir::Value *lower_expr(hir::ExprId id);
+    void lower_binary(hir::ExprId id);
+    void lower_call(hir::ExprId id);
+    coel::ir::Value *lower_range_test(coel::ir::BasicBlock *block, hir::ExprId id, std::size_t first,
+                                      std::size_t last);
+    coel::ir::Value *lower_pattern_test(hir::ExprId id, std::size_t index);
+    void lower_match_search(hir::ExprId id, std::size_t index, std::size_t length);
+    void lower_match_arm(hir::ExprId id, std::size_t index);
+    void lower_match_compare(hir::ExprId id, std::size_t index);
+    void lower_match_store(hir::ExprId id, std::size_t index);
+    void lower_expr(hir::ExprId id);
+    void lower_tail_call(hir::ExprId id);
+    void lower_tail_match_arm(hir::ExprId id, std::size_t index);
+    void lower_tail_match_compare(hir::ExprId id, std::size_t index);
+    void lower_tail(hir::ExprId id);
+    void run_task(const Task &task);
+    void lower(const Task &task);
+    void lower_tail_group(const std::vector<const hir::Function *> &members, coel::ir::Function *function);
+    void lower_tail_stub(const hir::Function &function, const TailGroup &group);
 
 public:
     explicit HirLowering(const hir::Root &root) : m_root(root) {}
 
+    void declare_function(const hir::Function &function);
+    void set_tail_groups(std::vector<std::vector<const hir::Function *>> &&groups);
+
     void visit(const hir::DeclStmt &decl_stmt) override;
     void visit(const hir::Function &function) override;
     void visit(const hir::ReturnStmt &return_stmt) override;
@@ -37,12 +167,187 @@ public:
     coel::ir::Unit &unit() { return m_unit; }
 };
 
+void TailCallCollector::collect(hir::ExprId id) {
+    std::vector<hir::ExprId> worklist{id};
+    while (!worklist.empty()) {
+        auto current = worklist.back();
+        worklist.pop_back();
+        const auto expr = m_root.expr(current);
+        switch (expr.kind()) {
+        case hir::ExprKind::Block:
+            if (auto value = expr.block_value()) {
+                worklist.push_back(*value);
+            }
+            break;
+        case hir::ExprKind::Call:
+            m_callees.push_back(expr.call_callee());
+            break;
+        case hir::ExprKind::Match:
+            for (auto [lhs, rhs] : m_root.match_arms(current)) {
+                worklist.push_back(rhs);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void TailCallCollector::visit(const hir::DeclStmt &) {}
+
+void TailCallCollector::visit(const hir::Function &function) {
+    for (const auto &stmt : m_root.block_stmts(function.block())) {
+        stmt.accept(this);
+    }
+}
+
+void TailCallCollector::visit(const hir::ReturnStmt &return_stmt) {
+    collect(return_stmt.value());
+}
+
+TailGroupFinder::TailGroupFinder(const hir::Root &root, const std::vector<const hir::Function *> &functions) {
+    for (const auto *function : functions) {
+        m_edges.emplace(function, std::vector<const hir::Function *>());
+        m_positions.emplace(function, m_positions.size());
+    }
+    for (const auto *function : functions) {
+        TailCallCollector collector(root);
+        function->accept(&collector);
+        auto &edges = m_edges.at(function);
+        for (const auto *callee : collector.callees()) {
+            // A tail call can only reuse the frame if it returns the same type. Callees outside of the given functions
+            // can't be part of a group.
+            if (m_edges.contains(callee) && root.type(callee->block()) == root.type(function->block())) {
+                edges.push_back(callee);
+            }
+        }
+    }
+    for (const auto *function : functions) {
+        if (!m_indices.contains(function)) {
+            connect(function);
+        }
+    }
+}
+
+void TailGroupFinder::connect(const hir::Function *function) {
+    const auto index = m_indices.size();
+    m_indices.emplace(function, std::make_pair(index, index));
+    m_stack.push_back(function);
+    m_on_stack[function] = true;
+    bool self_recursive = false;
+    for (const auto *callee : m_edges.at(function)) {
+        self_recursive |= callee == function;
+        if (!m_indices.contains(callee)) {
+            connect(callee);
+            m_indices.at(function).second = std::min(m_indices.at(function).second, m_indices.at(callee).second);
+        } else if (m_on_stack[callee]) {
+            m_indices.at(function).second = std::min(m_indices.at(function).second, m_indices.at(callee).first);
+        }
+    }
+    if (m_indices.at(function).first != m_indices.at(function).second) {
+        return;
+    }
+
+    std::vector<const hir::Function *> component;
+    const hir::Function *member = nullptr;
+    do {
+        member = m_stack.back();
+        m_stack.pop_back();
+        m_on_stack[member] = false;
+        component.push_back(member);
+    } while (member != function);
+    if (component.size() == 1 && !self_recursive) {
+        return;
+    }
+    std::sort(component.begin(), component.end(), [this](const auto *lhs, const auto *rhs) {
+        return m_positions.at(lhs) < m_positions.at(rhs);
+    });
+    m_groups.push_back(std::move(component));
+}
+
+void HirLowering::push_stmts(hir::ExprId block) {
+    // Push in reverse so that the first statement is lowered first.
+    for (std::size_t i = m_root.block_stmts(block).size(); i > 0; i--) {
+        m_tasks.push_back({TaskKind::Stmt, block, i - 1});
+    }
+}
+
+coel::ir::Value *HirLowering::pop_value() {
+    auto *value = m_values.back();
+    m_values.pop_back();
+    return value;
+}
+
+// Whether an arm of a match is always taken if reached, in which case its pattern needn't be tested. Analysis rejects a
+// default arm anywhere but last, and drops any arms after an exhaustive set of constant patterns.
+bool HirLowering::is_unconditional_arm(hir::ExprId id, std::size_t index) const {
+    const auto expr = m_root.expr(id);
+    if (index + 1 != expr.match_arm_count()) {
+        COEL_ASSERT(m_root.kind(m_root.match_arms(id)[index].first) != hir::ExprKind::Wildcard);
+        return false;
+    }
+    return expr.match_exhaustive() || m_root.kind(m_root.match_arms(id)[index].first) == hir::ExprKind::Wildcard;
+}
+
+// Finds the runs of arms which can be dispatched to with a binary search. A run is a maximal sequence of arms after the
+// hot ones with constant or range patterns. It must be long enough to be worth it, and no two of its patterns may
+// overlap so that the order in which the arms are tested doesn't matter.
+std::vector<std::pair<std::size_t, std::size_t>> HirLowering::find_search_runs(hir::ExprId id) const {
+    const auto arms = m_root.match_arms(id);
+    std::vector<std::pair<std::size_t, std::size_t>> runs;
+    std::vector<std::pair<std::size_t, std::size_t>> values;
+    for (auto i = m_root.expr(id).match_hot_arm_count(); i <= arms.size(); i++) {
+        if (i < arms.size() && !is_unconditional_arm(id, i)) {
+            if (auto pattern_values = m_root.pattern_values(arms[i].first)) {
+                values.push_back(*pattern_values);
+                continue;
+            }
+        }
+        if (values.size() >= k_min_search_arms) {
+            std::sort(values.begin(), values.end());
+            auto overlap = std::adjacent_find(values.begin(), values.end(), [](const auto &lhs, const auto &rhs) {
+                return rhs.first <= lhs.second;
+            });
+            if (overlap == values.end()) {
+                runs.emplace_back(i - values.size(), values.size());
+            }
+        }
+        values.clear();
+    }
+    return runs;
+}
+
+// Returns the number of arms in the binary search starting at index, or zero if none does.
+std::size_t HirLowering::take_search_run(std::size_t index) {
+    auto &frame = m_match_frames.back();
+    if (frame.next_search_run == frame.search_runs.size() || frame.search_runs[frame.next_search_run].first != index) {
+        return 0;
+    }
+    return frame.search_runs[frame.next_search_run++].second;
+}
+
+// Moves on to the arm after index. If it's part of the current binary search, the current block becomes its block and
+// true is returned. Otherwise the current block becomes the one reached if no earlier arm matched.
+bool HirLowering::advance_match_arm(std::size_t index) {
+    auto &frame = m_match_frames.back();
+    if (index + 1 > frame.search_begin && index + 1 - frame.search_begin < frame.search_blocks.size()) {
+        m_block = frame.search_blocks[index + 1 - frame.search_begin];
+        return true;
+    }
+    frame.search_blocks.clear();
+    m_block = frame.false_dst;
+    return false;
+}
+
 coel::ir::Value *HirLowering::lower_argument(std::size_t index) {
+    if (auto it = m_tail_entries.find(m_hir_function); it != m_tail_entries.end()) {
+        return m_block->append<coel::ir::LoadInst>(it->second.params[index]);
+    }
     return m_function->argument(index);
 }
 
-coel::ir::Value *HirLowering::lower_binary(hir::ExprKind op, hir::ExprId lhs_id, hir::ExprId rhs_id) {
-    auto ir_op = [op] {
+void HirLowering::lower_binary(hir::ExprId id) {
+    auto ir_op = [op = m_root.kind(id)] {
         switch (op) {
         case hir::ExprKind::Add:
             return coel::ir::BinaryOp::Add;
@@ -52,114 +357,518 @@ coel::ir::Value *HirLowering::lower_binary(hir::ExprKind op, hir::ExprId lhs_id,
             COEL_ENSURE_NOT_REACHED();
         }
     }();
-    auto *lhs = lower_expr(lhs_id);
-    auto *rhs = lower_expr(rhs_id);
-    return m_block->append<coel::ir::BinaryInst>(ir_op, lhs, rhs);
+    auto *rhs = pop_value();
+    auto *lhs = pop_value();
+    m_values.push_back(m_block->append<coel::ir::BinaryInst>(ir_op, lhs, rhs));
 }
 
-coel::ir::Value *HirLowering::lower_block(const coel::List<hir::Stmt> &stmts) {
-    for (const auto *stmt : stmts) {
-        stmt->accept(this);
+void HirLowering::lower_call(hir::ExprId id) {
+    const auto *callee = m_root.expr(id).call_callee();
+    std::vector<coel::ir::Value *> args(callee->params().size());
+    for (auto it = args.rbegin(); it != args.rend(); ++it) {
+        *it = pop_value();
     }
-    return nullptr;
+    m_values.push_back(m_block->append<coel::ir::CallInst>(m_function_map.at(callee), std::move(args)));
 }
 
-coel::ir::Value *HirLowering::lower_call(const hir::Function *callee, const hir::ExprId *arg_ids) {
-    std::vector<coel::ir::Value *> args;
-    for (std::size_t i = 0; i < callee->params().size(); i++) {
-        args.push_back(lower_expr(arg_ids[i]));
+// Tests whether the matchee of a match lies within [first, last]. A range is tested with a single unsigned comparison
+// of its offset from first, which wraps around for values below it.
+coel::ir::Value *HirLowering::lower_range_test(coel::ir::BasicBlock *block, hir::ExprId id, std::size_t first,
+                                               std::size_t last) {
+    const auto *type = m_root.type(m_root.expr(id).match_matchee()).real();
+    auto *matchee = m_match_frames.back().matchee;
+    if (first == last) {
+        return block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Eq, matchee,
+                                                    coel::ir::Constant::get(type, first));
     }
-    return m_block->append<coel::ir::CallInst>(m_function_map.at(callee), std::move(args));
+    if (first != 0) {
+        matchee = block->append<coel::ir::BinaryInst>(coel::ir::BinaryOp::Sub, matchee,
+                                                      coel::ir::Constant::get(type, first));
+    }
+    return block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Le, matchee,
+                                                coel::ir::Constant::get(type, last - first));
 }
 
-coel::ir::Value *HirLowering::lower_constant(const hir::Type &type, std::size_t value) {
-    return coel::ir::Constant::get(type.real(), value);
+// Tests the pattern of an arm against the matchee. Any pattern other than a range has had its value lowered already.
+coel::ir::Value *HirLowering::lower_pattern_test(hir::ExprId id, std::size_t index) {
+    const auto pattern = m_root.match_arms(id)[index].first;
+    if (m_root.kind(pattern) == hir::ExprKind::Range) {
+        const auto [first, last] = *m_root.pattern_values(pattern);
+        return lower_range_test(m_block, id, first, last);
+    }
+    auto *lhs = pop_value();
+    return m_block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Eq, m_match_frames.back().matchee, lhs);
 }
 
-coel::ir::Value *HirLowering::lower_match(const hir::Type &type, hir::ExprId matchee_id,
-                                          const std::pair<hir::ExprId, hir::ExprId> *arms, std::size_t arm_count) {
-    auto *matchee = lower_expr(matchee_id);
-    auto *result_var = m_function->append_stack_slot(type.real());
-    std::vector<coel::ir::BasicBlock *> blocks;
-    for (std::size_t i = 0; i < arm_count; i++) {
-        auto [lhs_id, rhs_id] = arms[i];
-        auto *lhs = lower_expr(lhs_id);
-        auto *compare = m_block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Eq, matchee, lhs);
-        auto *true_dst = m_function->append_block();
-        auto *false_dst = m_function->append_block();
-        m_block->append<coel::ir::CondBranchInst>(compare, true_dst, false_dst);
-        blocks.push_back(true_dst);
-        blocks.push_back(false_dst);
-        m_block = true_dst;
-        auto *rhs = lower_expr(rhs_id);
-        m_block->append<coel::ir::StoreInst>(result_var, rhs);
-        if (!m_block->has_terminator()) {
-            blocks.push_back(m_block);
-        }
-        m_block = false_dst;
+// Lowers a binary search over the values of a run of arms, leaving the current block as the first arm's block. Each
+// level of the search halves the arms left by comparing against the first value of the middle one, and a single range
+// test at each leaf either enters that arm or falls through to false_dst.
+void HirLowering::lower_match_search(hir::ExprId id, std::size_t index, std::size_t length) {
+    struct Case {
+        std::size_t first;
+        std::size_t last;
+        std::size_t arm;
+    };
+    std::vector<Case> cases;
+    for (std::size_t i = 0; i < length; i++) {
+        const auto [first, last] = *m_root.pattern_values(m_root.match_arms(id)[index + i].first);
+        cases.push_back({first, last, i});
+    }
+    std::sort(cases.begin(), cases.end(), [](const Case &lhs, const Case &rhs) {
+        return lhs.first < rhs.first;
+    });
+
+    auto &frame = m_match_frames.back();
+    const auto *type = m_root.type(m_root.expr(id).match_matchee()).real();
+    frame.search_begin = index;
+    frame.search_blocks.resize(length);
+    for (auto &block : frame.search_blocks) {
+        block = m_function->append_block();
+    }
+    frame.false_dst = m_function->append_block();
+
+    std::vector<std::tuple<coel::ir::BasicBlock *, std::size_t, std::size_t>> worklist{{m_block, 0, length}};
+    while (!worklist.empty()) {
+        auto [block, begin, end] = worklist.back();
+        worklist.pop_back();
+        if (end - begin == 1) {
+            const auto &leaf = cases[begin];
+            auto *test = lower_range_test(block, id, leaf.first, leaf.last);
+            block->append<coel::ir::CondBranchInst>(test, frame.search_blocks[leaf.arm], frame.false_dst);
+            continue;
+        }
+        const auto middle = begin + (end - begin) / 2;
+        auto *compare = block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Lt, frame.matchee,
+                                                             coel::ir::Constant::get(type, cases[middle].first));
+        auto *lower = m_function->append_block();
+        auto *upper = m_function->append_block();
+        block->append<coel::ir::CondBranchInst>(compare, lower, upper);
+        worklist.emplace_back(upper, middle, end);
+        worklist.emplace_back(lower, begin, middle);
+    }
+    m_block = frame.search_blocks.front();
+}
+
+void HirLowering::lower_match_arm(hir::ExprId id, std::size_t index) {
+    const auto expr = m_root.expr(id);
+    if (index == 0) {
+        auto *matchee = pop_value();
+        m_match_frames.push_back(
+            {matchee, m_function->append_stack_slot(expr.type().real()), nullptr, {}, find_search_runs(id), 0, 0, {}});
+    }
+    auto &frame = m_match_frames.back();
+    if (index < expr.match_arm_count() && is_unconditional_arm(id, index)) {
+        // Lower the arm straight into the current block, leaving no block to fall through to.
+        frame.false_dst = nullptr;
+        m_tasks.push_back({TaskKind::MatchStore, id, index});
+        m_tasks.push_back({TaskKind::Expr, m_root.match_arms(id)[index].second});
+        return;
+    }
+    if (auto length = take_search_run(index); length != 0) {
+        lower_match_search(id, index, length);
+        m_tasks.push_back({TaskKind::MatchStore, id, index});
+        m_tasks.push_back({TaskKind::Expr, m_root.match_arms(id)[index].second});
+        return;
+    }
+    if (index < expr.match_arm_count()) {
+        const auto pattern = m_root.match_arms(id)[index].first;
+        m_tasks.push_back({TaskKind::MatchCompare, id, index});
+        if (m_root.kind(pattern) != hir::ExprKind::Range) {
+            m_tasks.push_back({TaskKind::Expr, pattern});
+        }
+        return;
+    }
+    if (m_block != nullptr) {
+        // No arm matched, which evaluates to zero.
+        m_block->append<coel::ir::StoreInst>(frame.result_var, coel::ir::Constant::get(expr.type().real(), 0));
+        frame.blocks.push_back(m_block);
     }
     m_block = m_function->append_block();
-    for (auto *block : blocks) {
+    for (auto *block : frame.blocks) {
         if (!block->has_terminator()) {
             block->append<coel::ir::BranchInst>(m_block);
         }
     }
-    return m_block->append<coel::ir::LoadInst>(result_var);
+    auto *result_var = frame.result_var;
+    m_match_frames.pop_back();
+    m_values.push_back(m_block->append<coel::ir::LoadInst>(result_var));
+}
+
+void HirLowering::lower_match_compare(hir::ExprId id, std::size_t index) {
+    auto *compare = lower_pattern_test(id, index);
+    auto &frame = m_match_frames.back();
+    auto *true_dst = m_function->append_block();
+    frame.false_dst = m_function->append_block();
+    m_block->append<coel::ir::CondBranchInst>(compare, true_dst, frame.false_dst);
+    frame.blocks.push_back(true_dst);
+    m_block = true_dst;
+    m_tasks.push_back({TaskKind::MatchStore, id, index});
+    m_tasks.push_back({TaskKind::Expr, m_root.match_arms(id)[index].second});
 }
 
-coel::ir::Value *HirLowering::lower_var(hir::ExprId id) {
-    return m_block->append<coel::ir::LoadInst>(m_vars.at(id));
+void HirLowering::lower_match_store(hir::ExprId id, std::size_t index) {
+    auto &frame = m_match_frames.back();
+    auto *rhs = pop_value();
+    m_block->append<coel::ir::StoreInst>(frame.result_var, rhs);
+    if (!m_block->has_terminator()) {
+        frame.blocks.push_back(m_block);
+    }
+    if (advance_match_arm(index)) {
+        m_tasks.push_back({TaskKind::MatchStore, id, index + 1});
+        m_tasks.push_back({TaskKind::Expr, m_root.match_arms(id)[index + 1].second});
+        return;
+    }
+    m_tasks.push_back({TaskKind::MatchArm, id, index + 1});
 }
 
-coel::ir::Value *HirLowering::lower_expr(hir::ExprId id) {
-    const auto &expr = m_root.expr(id);
+void HirLowering::lower_expr(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
     switch (expr.kind()) {
     case hir::ExprKind::Argument:
-        return lower_argument(expr.argument_index());
+        m_values.push_back(lower_argument(expr.argument_index()));
+        break;
     case hir::ExprKind::Add:
     case hir::ExprKind::Sub:
-        return lower_binary(expr.kind(), expr.binary_lhs(), expr.binary_rhs());
+        m_tasks.push_back({TaskKind::Binary, id});
+        m_tasks.push_back({TaskKind::Expr, expr.binary_rhs()});
+        m_tasks.push_back({TaskKind::Expr, expr.binary_lhs()});
+        break;
     case hir::ExprKind::Block:
-        return lower_block(expr.block_stmts());
+        if (auto value = expr.block_value()) {
+            m_tasks.push_back({TaskKind::Expr, *value});
+        } else {
+            m_values.push_back(nullptr);
+        }
+        push_stmts(id);
+        break;
     case hir::ExprKind::Call:
-        return lower_call(expr.call_callee(), expr.call_args());
+        m_tasks.push_back({TaskKind::Call, id});
+        for (std::size_t i = expr.call_callee()->params().size(); i > 0; i--) {
+            m_tasks.push_back({TaskKind::Expr, m_root.call_args(id)[i - 1]});
+        }
+        break;
     case hir::ExprKind::Constant:
-        return lower_constant(expr.type(), expr.constant_value());
+        m_values.push_back(coel::ir::Constant::get(expr.type().real(), expr.constant_value()));
+        break;
     case hir::ExprKind::Match:
-        return lower_match(expr.type(), expr.match_matchee(), expr.match_arms(), expr.match_arm_count());
+        m_tasks.push_back({TaskKind::MatchArm, id, 0});
+        m_tasks.push_back({TaskKind::Expr, expr.match_matchee()});
+        break;
     case hir::ExprKind::Var:
-        return lower_var(id);
+        m_values.push_back(m_block->append<coel::ir::LoadInst>(m_vars.at(id)));
+        break;
+    case hir::ExprKind::Range:
+    case hir::ExprKind::Wildcard:
+        COEL_ENSURE_NOT_REACHED("Pattern lowered as an expression");
     }
 }
 
-void HirLowering::visit(const hir::DeclStmt &decl_stmt) {
-    auto *stack_slot = m_function->append_stack_slot(m_root.type(decl_stmt.var()).real());
-    auto *value = lower_expr(decl_stmt.value());
-    m_block->append<coel::ir::StoreInst>(stack_slot, value);
-    m_vars.emplace(decl_stmt.var(), stack_slot);
+void HirLowering::lower_tail_call(hir::ExprId id) {
+    // All of the arguments have been evaluated before reassigning any of the parameters, since the arguments may refer
+    // to them.
+    const auto *callee = m_root.expr(id).call_callee();
+    const auto &entry = m_tail_entries.at(callee);
+    for (std::size_t i = entry.params.size(); i > 0; i--) {
+        m_block->append<coel::ir::StoreInst>(entry.params[i - 1], pop_value());
+    }
+    m_block->append<coel::ir::BranchInst>(entry.header);
 }
 
-void HirLowering::visit(const hir::Function &function) {
+void HirLowering::lower_tail_match_arm(hir::ExprId id, std::size_t index) {
+    const auto expr = m_root.expr(id);
+    if (index == 0) {
+        m_match_frames.push_back({pop_value(), nullptr, nullptr, {}, find_search_runs(id), 0, 0, {}});
+    }
+    if (index < expr.match_arm_count() && is_unconditional_arm(id, index)) {
+        m_match_frames.back().false_dst = nullptr;
+        m_tasks.push_back({TaskKind::TailMatchNext, id, index});
+        m_tasks.push_back({TaskKind::Tail, m_root.match_arms(id)[index].second});
+        return;
+    }
+    if (auto length = take_search_run(index); length != 0) {
+        lower_match_search(id, index, length);
+        m_tasks.push_back({TaskKind::TailMatchNext, id, index});
+        m_tasks.push_back({TaskKind::Tail, m_root.match_arms(id)[index].second});
+        return;
+    }
+    if (index < expr.match_arm_count()) {
+        const auto pattern = m_root.match_arms(id)[index].first;
+        m_tasks.push_back({TaskKind::TailMatchCompare, id, index});
+        if (m_root.kind(pattern) != hir::ExprKind::Range) {
+            m_tasks.push_back({TaskKind::Expr, pattern});
+        }
+        return;
+    }
+    m_match_frames.pop_back();
+    if (!m_block->has_terminator()) {
+        // No arm matched, which returns zero.
+        m_block->append<coel::ir::RetInst>(coel::ir::Constant::get(m_root.type(m_hir_function->block()).real(), 0));
+    }
+}
+
+void HirLowering::lower_tail_match_compare(hir::ExprId id, std::size_t index) {
+    auto *compare = lower_pattern_test(id, index);
+    auto &frame = m_match_frames.back();
+    auto *true_dst = m_function->append_block();
+    frame.false_dst = m_function->append_block();
+    m_block->append<coel::ir::CondBranchInst>(compare, true_dst, frame.false_dst);
+    m_block = true_dst;
+    m_tasks.push_back({TaskKind::TailMatchNext, id, index});
+    m_tasks.push_back({TaskKind::Tail, m_root.match_arms(id)[index].second});
+}
+
+void HirLowering::lower_tail(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    switch (expr.kind()) {
+    case hir::ExprKind::Block:
+        COEL_ASSERT(expr.block_value());
+        m_tasks.push_back({TaskKind::Tail, *expr.block_value()});
+        push_stmts(id);
+        return;
+    case hir::ExprKind::Call:
+        if (m_tail_entries.contains(expr.call_callee())) {
+            m_tasks.push_back({TaskKind::TailCall, id});
+            for (std::size_t i = expr.call_callee()->params().size(); i > 0; i--) {
+                m_tasks.push_back({TaskKind::Expr, m_root.call_args(id)[i - 1]});
+            }
+            return;
+        }
+        break;
+    case hir::ExprKind::Match:
+        m_tasks.push_back({TaskKind::TailMatchArm, id, 0});
+        m_tasks.push_back({TaskKind::Expr, expr.match_matchee()});
+        return;
+    default:
+        break;
+    }
+    m_tasks.push_back({TaskKind::Ret});
+    m_tasks.push_back({TaskKind::Expr, id});
+}
+
+void HirLowering::run_task(const Task &task) {
+    switch (task.kind) {
+    case TaskKind::Expr:
+        lower_expr(task.id);
+        break;
+    case TaskKind::Tail:
+        lower_tail(task.id);
+        break;
+    case TaskKind::Stmt:
+        m_root.block_stmts(task.id)[task.index].accept(this);
+        break;
+    case TaskKind::Binary:
+        lower_binary(task.id);
+        break;
+    case TaskKind::Call:
+        lower_call(task.id);
+        break;
+    case TaskKind::Decl: {
+        auto *stack_slot = m_function->append_stack_slot(m_root.type(task.id).real());
+        m_block->append<coel::ir::StoreInst>(stack_slot, pop_value());
+        m_vars.emplace(task.id, stack_slot);
+        break;
+    }
+    case TaskKind::MatchArm:
+        lower_match_arm(task.id, task.index);
+        break;
+    case TaskKind::MatchCompare:
+        lower_match_compare(task.id, task.index);
+        break;
+    case TaskKind::MatchStore:
+        lower_match_store(task.id, task.index);
+        break;
+    case TaskKind::Ret:
+        m_block->append<coel::ir::RetInst>(pop_value());
+        break;
+    case TaskKind::TailCall:
+        lower_tail_call(task.id);
+        break;
+    case TaskKind::TailMatchArm:
+        lower_tail_match_arm(task.id, task.index);
+        break;
+    case TaskKind::TailMatchCompare:
+        lower_tail_match_compare(task.id, task.index);
+        break;
+    case TaskKind::TailMatchNext:
+        // After an arm which is always taken there's no block left to fall through to. The arm's own block, which it
+        // has terminated, stays current like after any other return, since dead statements may follow the match.
+        if (m_match_frames.back().false_dst == nullptr) {
+            m_tasks.push_back({TaskKind::TailMatchArm, task.id, task.index + 1});
+            break;
+        }
+        if (advance_match_arm(task.index)) {
+            m_tasks.push_back({TaskKind::TailMatchNext, task.id, task.index + 1});
+            m_tasks.push_back({TaskKind::Tail, m_root.match_arms(task.id)[task.index + 1].second});
+            break;
+        }
+        m_tasks.push_back({TaskKind::TailMatchArm, task.id, task.index + 1});
+        break;
+    }
+}
+
+void HirLowering::lower(const Task &task) {
+    m_tasks.push_back(task);
+    while (!m_tasks.empty()) {
+        auto next = m_tasks.back();
+        m_tasks.pop_back();
+        run_task(next);
+    }
+    m_values.clear();
+}
+
+void HirLowering::declare_function(const hir::Function &function) {
     std::vector<const coel::ir::Type *> parameters(function.params().size());
     std::transform(function.params().begin(), function.params().end(), parameters.begin(), [this](hir::ExprId id) {
         return m_root.type(id).real();
     });
-    m_function = m_unit.append_function(function.name(), m_root.type(function.block()).real(), parameters);
+    m_function_map.emplace(&function,
+                           m_unit.append_function(function.name(), m_root.type(function.block()).real(), parameters));
+
+    // Declare the shared function of a group right after its first member, so that it's laid out next to it.
+    auto it = m_tail_group_indices.find(&function);
+    if (it == m_tail_group_indices.end() || m_tail_groups[it->second].members.size() == 1 ||
+        m_tail_groups[it->second].shared != nullptr) {
+        return;
+    }
+    auto &group = m_tail_groups[it->second];
+    std::vector<const coel::ir::Type *> shared_parameters{selector_type()};
+    for (const auto *member : group.members) {
+        for (hir::ExprId param : member->params()) {
+            shared_parameters.push_back(m_root.type(param).real());
+        }
+    }
+    group.shared = m_unit.append_function(function.name() + ".group", m_root.type(function.block()).real(),
+                                          shared_parameters);
+}
+
+void HirLowering::set_tail_groups(std::vector<std::vector<const hir::Function *>> &&groups) {
+    m_tail_groups.clear();
+    m_tail_group_indices.clear();
+    for (auto &members : groups) {
+        for (const auto *member : members) {
+            m_tail_group_indices.emplace(member, m_tail_groups.size());
+        }
+        m_tail_groups.push_back({std::move(members)});
+    }
+}
+
+// Lowers the bodies of a tail group into function. Each member's parameters are spilled to stack slots, so that a tail
+// call within the group can reassign the parameters of the callee and jump to its body rather than growing the stack.
+void HirLowering::lower_tail_group(const std::vector<const hir::Function *> &members, coel::ir::Function *function) {
+    m_function = function;
+    m_block = m_function->append_block();
+    m_tail_entries.clear();
+    m_vars.clear();
+    for (const auto *member : members) {
+        auto &entry = m_tail_entries[member];
+        entry.header = m_function->append_block();
+        for (hir::ExprId param : member->params()) {
+            entry.params.push_back(m_function->append_stack_slot(m_root.type(param).real()));
+        }
+    }
+
+    // A shared function selects the member to enter with its first argument.
+    const bool shared = members.size() > 1;
+    std::size_t arg_index = shared ? 1 : 0;
+    for (std::size_t i = 0; i < members.size(); i++) {
+        auto *block = m_block;
+        if (shared && i + 1 < members.size()) {
+            auto *compare = m_block->append<coel::ir::CompareInst>(coel::ir::CompareOp::Eq, m_function->argument(0),
+                                                                   coel::ir::Constant::get(selector_type(), i));
+            block = m_function->append_block();
+            auto *next = m_function->append_block();
+            m_block->append<coel::ir::CondBranchInst>(compare, block, next);
+            m_block = next;
+        }
+        const auto &entry = m_tail_entries.at(members[i]);
+        for (auto *param : entry.params) {
+            block->append<coel::ir::StoreInst>(param, m_function->argument(arg_index++));
+        }
+        block->append<coel::ir::BranchInst>(entry.header);
+    }
+    for (const auto *member : members) {
+        m_hir_function = member;
+        m_block = m_tail_entries.at(member).header;
+        lower({TaskKind::Expr, member->block()});
+    }
+}
+
+// Lowers a member of a shared tail group to a call of the shared function, passing zero for the parameters of the
+// other members.
+void HirLowering::lower_tail_stub(const hir::Function &function, const TailGroup &group) {
+    m_function = m_function_map.at(&function);
     m_block = m_function->append_block();
-    m_function_map.emplace(&function, m_function);
-    lower_expr(function.block());
+    const auto selector = static_cast<std::size_t>(
+        std::find(group.members.begin(), group.members.end(), &function) - group.members.begin());
+    std::vector<coel::ir::Value *> args{coel::ir::Constant::get(selector_type(), selector)};
+    for (const auto *member : group.members) {
+        for (std::size_t i = 0; i < member->params().size(); i++) {
+            if (member == &function) {
+                args.push_back(m_function->argument(i));
+            } else {
+                args.push_back(coel::ir::Constant::get(m_root.type(member->params()[i]).real(), 0));
+            }
+        }
+    }
+    m_block->append<coel::ir::RetInst>(m_block->append<coel::ir::CallInst>(group.shared, std::move(args)));
+}
+
+void HirLowering::visit(const hir::DeclStmt &decl_stmt) {
+    m_tasks.push_back({TaskKind::Decl, decl_stmt.var()});
+    m_tasks.push_back({TaskKind::Expr, decl_stmt.value()});
+}
+
+void HirLowering::visit(const hir::Function &function) {
+    auto it = m_tail_group_indices.find(&function);
+    if (it == m_tail_group_indices.end()) {
+        m_function = m_function_map.at(&function);
+        m_block = m_function->append_block();
+        m_hir_function = &function;
+        m_tail_entries.clear();
+        m_vars.clear();
+        lower({TaskKind::Expr, function.block()});
+        return;
+    }
+    const auto &group = m_tail_groups[it->second];
+    if (group.shared == nullptr) {
+        lower_tail_group(group.members, m_function_map.at(&function));
+        return;
+    }
+    lower_tail_stub(function, group);
+    if (&function == group.members.front()) {
+        lower_tail_group(group.members, group.shared);
+    }
 }
 
 void HirLowering::visit(const hir::ReturnStmt &return_stmt) {
-    auto *value = lower_expr(return_stmt.value());
-    m_block->append<coel::ir::RetInst>(value);
+    m_tasks.push_back({TaskKind::Tail, return_stmt.value()});
 }
 
 } // namespace
 
-coel::ir::Unit lower_hir(const hir::Root &root) {
+coel::ir::Unit lower_hir(const hir::Root &root, const std::vector<const hir::Function *> &functions) {
+    TailGroupFinder tail_group_finder(root, functions);
+    HirLowering lowering(root);
+    lowering.set_tail_groups(std::move(tail_group_finder.groups()));
+    for (const auto *function : functions) {
+        lowering.declare_function(*function);
+    }
+    for (const auto *function : functions) {
+        function->accept(&lowering);
+    }
+    return std::move(lowering.unit());
+}
+
+coel::ir::Unit lower_hir(const hir::Root &root, const std::vector<const hir::Function *> &functions,
+                         const std::function<void(const hir::Function &)> &build_body) {
     HirLowering lowering(root);
-    for (const auto *function : root) {
+    for (const auto *function : functions) {
+        lowering.declare_function(*function);
+    }
+    for (const auto *function : functions) {
+        build_body(*function);
+        TailGroupFinder tail_group_finder(root, {function});
+        lowering.set_tail_groups(std::move(tail_group_finder.groups()));
         function->accept(&lowering);
     }
     return std::move(lowering.unit());
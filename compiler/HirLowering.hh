@@ -2,10 +2,22 @@
 
 #include <coel/ir/Unit.hh>
 
+#include <functional>
+#include <vector>
+
 namespace hir {
 
+class Function;
 class Root;
 
 } // namespace hir
 
-coel::ir::Unit lower_hir(const hir::Root &root);
+// Lowers the given functions, in the given order, into a new unit. Every callee of a lowered function must also be in
+// the list.
+coel::ir::Unit lower_hir(const hir::Root &root, const std::vector<const hir::Function *> &functions);
+
+// Lowers the given functions one at a time, calling build_body to build each function's body in root just before it is
+// lowered. build_body may discard the bodies of previously lowered functions, so tail calls are only lowered to jumps
+// within a single self-recursive function.
+coel::ir::Unit lower_hir(const hir::Root &root, const std::vector<const hir::Function *> &functions,
+                         const std::function<void(const hir::Function &)> &build_body);
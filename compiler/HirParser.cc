@@ -0,0 +1,332 @@
+#include <HirParser.hh>
+
+#include <Diagnostic.hh>
+#include <Grammar.hh>
+#include <Lexer.hh>
+#include <Token.hh>
+
+#include <coel/ir/Types.hh>
+#include <coel/support/Assert.hh>
+
+#include <algorithm>
+#include <charconv>
+#include <span>
+#include <string>
+
+namespace {
+
+constexpr hir::ExprKind binary_kind(Operator op) {
+    switch (op) {
+    case Operator::Add:
+        return hir::ExprKind::Add;
+    case Operator::Sub:
+        return hir::ExprKind::Sub;
+    }
+}
+
+} // namespace
+
+hir::Type HirParser::parse_type() {
+    auto name = expect(m_lexer, TokenKind::Identifier).text();
+    std::size_t bit_width = 0;
+    if (name.starts_with('u')) {
+        auto [end, error] = std::from_chars(name.data() + 1, name.data() + name.length(), bit_width);
+        if (error == std::errc() && end == name.data() + name.length()) {
+            return coel::ir::IntegerType::get(bit_width);
+        }
+    }
+    Diagnostic(m_lexer.location(), "unknown type '{}'", name);
+    COEL_ENSURE_NOT_REACHED();
+}
+
+hir::ExprId HirParser::parse_call_expr(const SourceLocation &location, std::string_view callee) {
+    // Arguments are gathered on a shared buffer, which nested calls push onto and pop off of.
+    const auto mark = m_arg_buffer.size();
+    expect(m_lexer, TokenKind::LeftParen);
+    while (m_lexer.peek().kind() != TokenKind::RightParen) {
+        auto arg = parse_expr();
+        m_arg_buffer.push_back(arg);
+        consume(m_lexer, TokenKind::Comma);
+    }
+    expect(m_lexer, TokenKind::RightParen);
+
+    std::span<const hir::ExprId> args(m_arg_buffer.data() + mark, m_arg_buffer.size() - mark);
+    hir::ExprId call;
+    if (const auto *function = find_function(callee)) {
+        call = m_root.create_call(location, function, m_root.type(function->block()), args);
+    } else {
+        if (m_signatures_known) {
+            Diagnostic(location, "attempted call of undeclared function '{}'", callee);
+        }
+        // The callee may be declared later on, so resolve the call once the whole file has been parsed.
+        call = m_root.create_call(location, nullptr, hir::TypeKind::Infer, args);
+        m_pending_calls.push_back({call, callee, location});
+    }
+    m_arg_buffer.resize(mark);
+    return call;
+}
+
+// Parses a default pattern, a range pattern, or an expression to compare against.
+hir::ExprId HirParser::parse_pattern() {
+    if (consume(m_lexer, TokenKind::Underscore)) {
+        return m_root.create_expr(m_lexer.location(), hir::ExprKind::Wildcard, hir::TypeKind::Infer);
+    }
+    // The location of the peeked token which starts the pattern.
+    const auto location = m_lexer.location();
+    auto first = parse_expr();
+    const auto first_expr = m_root.expr(first);
+    const auto first_value =
+        first_expr.kind() == hir::ExprKind::Constant ? std::make_optional(first_expr.constant_value()) : std::nullopt;
+    auto last_value = parse_range_last(m_lexer, location, first_value);
+    if (!last_value) {
+        return first;
+    }
+    // The last value is inclusive, so exclusive ranges are stored like inclusive ones.
+    auto last = m_root.create_expr(m_lexer.location(), hir::ExprKind::Constant, *last_value);
+    return m_root.create_expr(location, hir::ExprKind::Range, first, last);
+}
+
+hir::ExprId HirParser::parse_match_expr() {
+    expect(m_lexer, TokenKind::KeywordMatch);
+    auto location = m_lexer.location();
+    expect(m_lexer, TokenKind::LeftParen);
+    auto matchee = parse_expr();
+    expect(m_lexer, TokenKind::RightParen);
+    expect(m_lexer, TokenKind::LeftBrace);
+    const auto mark = m_arm_buffer.size();
+    while (m_lexer.peek().kind() != TokenKind::RightBrace) {
+        auto arm_lhs = parse_pattern();
+        expect(m_lexer, TokenKind::Arrow);
+        auto arm_rhs = parse_expr();
+        m_arm_buffer.emplace_back(arm_lhs, arm_rhs);
+        expect(m_lexer, TokenKind::Comma);
+    }
+    expect(m_lexer, TokenKind::RightBrace);
+
+    std::span<const std::pair<hir::ExprId, hir::ExprId>> arms(m_arm_buffer.data() + mark, m_arm_buffer.size() - mark);
+    auto match = m_root.create_match(location, matchee, arms);
+    m_arm_buffer.resize(mark);
+    return match;
+}
+
+hir::ExprId HirParser::parse_expr() {
+    auto parse_operand = [this]() -> std::optional<hir::ExprId> {
+        switch (m_lexer.peek().kind()) {
+        case TokenKind::Identifier: {
+            auto name = expect(m_lexer, TokenKind::Identifier).text();
+            auto location = m_lexer.location();
+            if (m_lexer.peek().kind() == TokenKind::LeftParen) {
+                return parse_call_expr(location, name);
+            }
+            return m_symbols.lookup_symbol(location, name);
+        }
+        case TokenKind::IntLit: {
+            auto number = expect(m_lexer, TokenKind::IntLit).number();
+            return m_root.create_expr(m_lexer.location(), hir::ExprKind::Constant, number);
+        }
+        case TokenKind::KeywordMatch:
+            return parse_match_expr();
+        case TokenKind::LeftBrace: {
+            auto location = m_lexer.location();
+            auto value = parse_block();
+            if (!value) {
+                Diagnostic(location, "block used as an expression must yield a value");
+            }
+            return *value;
+        }
+        default:
+            return std::nullopt;
+        }
+    };
+    auto create_binary = [this](const SourceLocation &location, Operator op, hir::ExprId lhs, hir::ExprId rhs) {
+        return m_root.create_expr(location, binary_kind(op), lhs, rhs);
+    };
+    return parse_binary_expr<hir::ExprId>(m_lexer, parse_operand, create_binary);
+}
+
+void HirParser::parse_stmt(std::optional<hir::ExprId> &yield_value) {
+    auto location = m_lexer.location();
+    if (consume(m_lexer, TokenKind::KeywordLet)) {
+        auto name = expect(m_lexer, TokenKind::Identifier).text();
+        expect(m_lexer, TokenKind::Eq);
+        auto value = parse_expr();
+        expect(m_lexer, TokenKind::Semi);
+        auto var = m_root.create_expr(location, hir::ExprKind::Var, hir::TypeKind::Infer);
+        m_root.append_stmt(m_block, hir::DeclStmt(var, value));
+        m_symbols.put_symbol(location, name, var);
+        return;
+    }
+    if (consume(m_lexer, TokenKind::KeywordReturn)) {
+        auto value = parse_expr();
+        expect(m_lexer, TokenKind::Semi);
+        m_root.append_stmt(m_block, hir::ReturnStmt(value));
+        return;
+    }
+    if (consume(m_lexer, TokenKind::KeywordYield)) {
+        auto value = parse_expr();
+        expect(m_lexer, TokenKind::Semi);
+        if (m_symbols.parent_kind() == ScopeKind::Function) {
+            // Emit a return statement if yielding from a function.
+            m_root.append_stmt(m_block, hir::ReturnStmt(value));
+        } else {
+            yield_value = value;
+        }
+        return;
+    }
+    const auto &actual = m_lexer.peek();
+    Diagnostic(m_lexer.location(), "expected a statement but got {}", actual.to_string());
+}
+
+std::optional<hir::ExprId> HirParser::parse_block() {
+    // Statements in nested blocks are flattened into the enclosing function's block, as in AST lowering.
+    m_symbols.enter_scope(ScopeKind::Block);
+    expect(m_lexer, TokenKind::LeftBrace);
+    std::optional<hir::ExprId> yield_value;
+    while (m_lexer.has_next() && m_lexer.peek().kind() != TokenKind::RightBrace) {
+        parse_stmt(yield_value);
+    }
+    expect(m_lexer, TokenKind::RightBrace);
+    m_symbols.leave_scope();
+    return yield_value;
+}
+
+std::size_t HirParser::parse_signature() {
+    expect(m_lexer, TokenKind::KeywordFn);
+    auto name = expect(m_lexer, TokenKind::Identifier).text();
+    expect(m_lexer, TokenKind::LeftParen);
+    auto location = m_lexer.location();
+    std::vector<Param> params;
+    while (m_lexer.peek().kind() != TokenKind::RightParen) {
+        expect(m_lexer, TokenKind::KeywordLet);
+        auto arg_location = m_lexer.location();
+        auto arg_name = expect(m_lexer, TokenKind::Identifier).text();
+        expect(m_lexer, TokenKind::Colon);
+        params.push_back({arg_location, arg_name, parse_type()});
+        consume(m_lexer, TokenKind::Comma);
+    }
+    expect(m_lexer, TokenKind::RightParen);
+    if (!consume(m_lexer, TokenKind::Colon)) {
+        Diagnostic(location, "missing return type for function '{}'", name);
+    }
+    auto return_type = parse_type();
+
+    auto [it, inserted] = m_signature_map.emplace(name, m_signatures.size());
+    if (!inserted) {
+        Diagnostic diagnostic(location, "attempted redeclaration of function '{}'", name);
+        diagnostic.add_note(m_signatures[it->second].location, "function originally declared here");
+    }
+    m_signatures.push_back({name, location, std::move(params), return_type, m_lexer.mark()});
+    return m_signatures.size() - 1;
+}
+
+void HirParser::skip_body() {
+    expect(m_lexer, TokenKind::LeftBrace);
+    for (std::size_t depth = 1; depth != 0;) {
+        switch (m_lexer.next().kind()) {
+        case TokenKind::LeftBrace:
+            depth++;
+            break;
+        case TokenKind::RightBrace:
+            depth--;
+            break;
+        case TokenKind::Eof:
+            Diagnostic(m_lexer.location(), "unexpected end of file in function body");
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void HirParser::scan_signatures() {
+    while (m_lexer.has_next()) {
+        parse_signature();
+        skip_body();
+    }
+    m_signatures_known = true;
+}
+
+void HirParser::parse_bodies() {
+    while (!m_body_worklist.empty()) {
+        const auto &signature = m_signatures[m_body_worklist.back()];
+        m_body_worklist.pop_back();
+        m_lexer.seek(signature.body);
+        m_symbols.enter_scope(ScopeKind::Function);
+        for (std::size_t i = 0; i < signature.params.size(); i++) {
+            const auto &param = signature.params[i];
+            m_symbols.put_symbol(param.location, param.name, signature.function->params()[i]);
+        }
+        m_block = signature.function->block();
+        parse_block();
+        m_symbols.leave_scope();
+    }
+}
+
+hir::Function *HirParser::declare_function(std::size_t index) {
+    auto &signature = m_signatures[index];
+    std::vector<hir::ExprId> params;
+    for (const auto &param : signature.params) {
+        params.push_back(m_root.create_expr(param.location, hir::ExprKind::Argument, param.type, params.size()));
+    }
+    signature.function = m_root.append_function(std::string(signature.name), std::move(params));
+    signature.function->set_block(m_root.create_expr(signature.location, hir::ExprKind::Block, signature.return_type));
+    m_body_worklist.push_back(index);
+    return signature.function;
+}
+
+hir::Function *HirParser::find_function(std::string_view name) {
+    auto it = m_signature_map.find(name);
+    if (it == m_signature_map.end()) {
+        return nullptr;
+    }
+    // In lazy mode, the first call to a function is what causes its body to be parsed.
+    auto &signature = m_signatures[it->second];
+    return signature.function != nullptr ? signature.function : declare_function(it->second);
+}
+
+hir::Root HirParser::parse() {
+    m_symbols.enter_scope(ScopeKind::Root);
+    if (m_lazy) {
+        scan_signatures();
+        // Without a main function, everything is reachable.
+        if (auto it = m_signature_map.find("main"); it != m_signature_map.end()) {
+            declare_function(it->second);
+        } else {
+            for (std::size_t i = 0; i < m_signatures.size(); i++) {
+                declare_function(i);
+            }
+            std::reverse(m_body_worklist.begin(), m_body_worklist.end());
+        }
+        parse_bodies();
+    } else {
+        while (m_lexer.has_next()) {
+            declare_function(parse_signature());
+            parse_bodies();
+        }
+    }
+    for (const auto &pending : m_pending_calls) {
+        const auto *callee = find_function(pending.callee);
+        if (callee == nullptr) {
+            Diagnostic(pending.location, "attempted call of undeclared function '{}'", pending.callee);
+        }
+        m_root.resolve_call(pending.call, callee);
+    }
+    m_symbols.leave_scope();
+    return std::move(m_root);
+}
+
+std::vector<const hir::Function *> HirParser::parse_signatures() {
+    m_symbols.enter_scope(ScopeKind::Root);
+    scan_signatures();
+    std::vector<const hir::Function *> functions;
+    for (std::size_t i = 0; i < m_signatures.size(); i++) {
+        functions.push_back(declare_function(i));
+    }
+    m_body_worklist.clear();
+    return functions;
+}
+
+void HirParser::parse_body(const hir::Function &function) {
+    m_body_worklist.push_back(m_signature_map.at(function.name()));
+    parse_bodies();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <CharStream.hh>
+#include <Hir.hh>
+#include <SourceLocation.hh>
+#include <SymbolTable.hh>
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Lexer;
+
+// A parser which builds HIR directly from the token stream, without building an intermediate AST. Symbols are resolved
+// in the same way as in AST lowering, and the same HIR is produced.
+//
+// In lazy mode, a first pass only parses function signatures and skips over their bodies. Bodies are then parsed on
+// demand, starting from main, as calls reach them. Unreachable functions are never parsed beyond their signature and
+// never make it into the HIR.
+//
+// Alternatively, parse_signatures and parse_body allow a driver to parse one function body at a time.
+class HirParser {
+    struct Param {
+        SourceLocation location;
+        std::string_view name;
+        hir::Type type;
+    };
+
+    struct Signature {
+        std::string_view name;
+        SourceLocation location;
+        std::vector<Param> params;
+        hir::Type return_type;
+        CharStream::Position body;
+        hir::Function *function{nullptr};
+    };
+
+    struct PendingCall {
+        hir::ExprId call;
+        std::string_view callee;
+        SourceLocation location;
+    };
+
+    Lexer &m_lexer;
+    const bool m_lazy;
+    hir::Root m_root;
+    SymbolTable m_symbols{m_root};
+    std::vector<Signature> m_signatures;
+    std::unordered_map<std::string_view, std::size_t> m_signature_map;
+    std::vector<std::size_t> m_body_worklist;
+    bool m_signatures_known{false};
+    std::vector<PendingCall> m_pending_calls;
+    hir::ExprId m_block{0};
+    std::vector<hir::ExprId> m_arg_buffer;
+    std::vector<std::pair<hir::ExprId, hir::ExprId>> m_arm_buffer;
+
+    hir::Type parse_type();
+    hir::ExprId parse_call_expr(const SourceLocation &location, std::string_view callee);
+    hir::ExprId parse_pattern();
+    hir::ExprId parse_match_expr();
+    hir::ExprId parse_expr();
+    void parse_stmt(std::optional<hir::ExprId> &yield_value);
+    std::optional<hir::ExprId> parse_block();
+    std::size_t parse_signature();
+    void skip_body();
+    void scan_signatures();
+    void parse_bodies();
+    hir::Function *declare_function(std::size_t index);
+    hir::Function *find_function(std::string_view name);
+
+public:
+    HirParser(Lexer &lexer, bool lazy) : m_lexer(lexer), m_lazy(lazy) {}
+
+    hir::Root parse();
+
+    // Parses and declares the signature of every function, skipping over their bodies. Returns the functions in source
+    // order.
+    std::vector<const hir::Function *> parse_signatures();
+
+    // Parses the body of a function declared by parse_signatures into the function's block.
+    void parse_body(const hir::Function &function);
+
+    hir::Root &root() { return m_root; }
+};
@@ -0,0 +1,254 @@
+#include <HirWalker.hh>
+
+#include <coel/ir/Types.hh>
+#include <coel/support/Assert.hh>
+
+#include <utility>
+#include <vector>
+
+namespace {
+
+class CallWalker final : public hir::Visitor {
+    const hir::Root &m_root;
+    const std::function<void(hir::ExprId)> &m_callback;
+    std::vector<hir::ExprId> m_worklist;
+
+    void walk(hir::ExprId id);
+
+public:
+    CallWalker(const hir::Root &root, const std::function<void(hir::ExprId)> &callback)
+        : m_root(root), m_callback(callback) {}
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+};
+
+void CallWalker::walk(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    switch (expr.kind()) {
+    case hir::ExprKind::Argument:
+    case hir::ExprKind::Constant:
+    case hir::ExprKind::Var:
+    case hir::ExprKind::Wildcard:
+        break;
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub:
+    case hir::ExprKind::Range:
+        m_worklist.push_back(expr.binary_lhs());
+        m_worklist.push_back(expr.binary_rhs());
+        break;
+    case hir::ExprKind::Block:
+        for (const auto &stmt : m_root.block_stmts(id)) {
+            stmt.accept(this);
+        }
+        if (auto value = expr.block_value()) {
+            m_worklist.push_back(*value);
+        }
+        break;
+    case hir::ExprKind::Call:
+        m_callback(id);
+        for (hir::ExprId arg : m_root.call_args(id)) {
+            m_worklist.push_back(arg);
+        }
+        break;
+    case hir::ExprKind::Match:
+        m_worklist.push_back(expr.match_matchee());
+        for (auto [lhs, rhs] : m_root.match_arms(id)) {
+            m_worklist.push_back(lhs);
+            m_worklist.push_back(rhs);
+        }
+        break;
+    }
+}
+
+void CallWalker::visit(const hir::DeclStmt &decl_stmt) {
+    m_worklist.push_back(decl_stmt.value());
+}
+
+void CallWalker::visit(const hir::Function &function) {
+    m_worklist.push_back(function.block());
+    while (!m_worklist.empty()) {
+        auto id = m_worklist.back();
+        m_worklist.pop_back();
+        walk(id);
+    }
+}
+
+void CallWalker::visit(const hir::ReturnStmt &return_stmt) {
+    m_worklist.push_back(return_stmt.value());
+}
+
+} // namespace
+
+void for_each_call(const hir::Root &root, const hir::Function &function,
+                   const std::function<void(hir::ExprId)> &callback) {
+    CallWalker walker(root, callback);
+    function.accept(&walker);
+}
+
+std::optional<std::size_t> Cloner::constant_value(hir::ExprId id) const {
+    const auto expr = m_root.expr(id);
+    if (expr.kind() != hir::ExprKind::Constant) {
+        return std::nullopt;
+    }
+    return expr.constant_value();
+}
+
+// Returns whether a cloned pattern matches a constant matchee, if that's known.
+std::optional<bool> Cloner::pattern_matches(hir::ExprId pattern, std::size_t value) const {
+    if (m_root.kind(pattern) == hir::ExprKind::Wildcard) {
+        return true;
+    }
+    if (auto values = m_root.pattern_values(pattern)) {
+        return value >= values->first && value <= values->second;
+    }
+    return std::nullopt;
+}
+
+hir::ExprId Cloner::create_constant(const SourceLocation &location, const hir::Type &type, std::size_t value) {
+    // Wrap the folded value to the width of its type.
+    if (const auto *integer_type = type.real()->as<coel::ir::IntegerType>()) {
+        if (integer_type->bit_width() < 64) {
+            value &= (std::size_t(1) << integer_type->bit_width()) - 1;
+        }
+    }
+    auto id = m_root.create_expr(location, hir::ExprKind::Constant, value);
+    m_root.set_type(id, type);
+    return id;
+}
+
+hir::ExprId Cloner::clone_match(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    const auto location = expr.location();
+    const auto type = expr.type();
+    const auto arm_count = expr.match_arm_count();
+    auto matchee = clone_expr(expr.match_matchee());
+    auto matchee_value = constant_value(matchee);
+    auto exhaustive = expr.match_exhaustive();
+    std::vector<std::pair<hir::ExprId, hir::ExprId>> arms;
+    for (std::size_t i = 0; i < arm_count; i++) {
+        auto lhs = clone_expr(m_root.match_arms(id)[i].first);
+        auto matches = matchee_value ? pattern_matches(lhs, *matchee_value) : std::nullopt;
+        if (matches && !*matches) {
+            // The arm can never be taken.
+            continue;
+        }
+        const bool always_taken = m_root.kind(lhs) == hir::ExprKind::Wildcard || matches.value_or(false);
+        if (always_taken && arms.empty()) {
+            // The arm is always taken, and no earlier arm can be.
+            return clone_expr(m_root.match_arms(id)[i].second);
+        }
+        auto rhs = clone_expr(m_root.match_arms(id)[i].second);
+        arms.emplace_back(lhs, rhs);
+        if (always_taken) {
+            // The arm is always taken if reached, so any later arms are dead.
+            exhaustive = true;
+            break;
+        }
+    }
+    auto clone = m_root.create_match(location, matchee, arms, exhaustive, expr.match_hot_arm_count());
+    m_root.set_type(clone, type);
+    return clone;
+}
+
+hir::ExprId Cloner::clone_expr(hir::ExprId id) {
+    if (auto it = m_map.find(id); it != m_map.end()) {
+        return it->second;
+    }
+
+    // Creating expressions may invalidate references into the root, so copy out everything needed up front.
+    const auto expr = m_root.expr(id);
+    const auto location = expr.location();
+    const auto type = expr.type();
+    switch (expr.kind()) {
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub: {
+        auto kind = expr.kind();
+        auto rhs_id = expr.binary_rhs();
+        auto lhs = clone_expr(expr.binary_lhs());
+        auto rhs = clone_expr(rhs_id);
+        auto lhs_value = constant_value(lhs);
+        auto rhs_value = constant_value(rhs);
+        if (lhs_value && rhs_value) {
+            auto value = kind == hir::ExprKind::Add ? *lhs_value + *rhs_value : *lhs_value - *rhs_value;
+            return create_constant(location, type, value);
+        }
+        auto clone = m_root.create_expr(location, kind, lhs, rhs);
+        m_root.set_type(clone, type);
+        return clone;
+    }
+    case hir::ExprKind::Block: {
+        auto clone = m_root.create_expr(location, hir::ExprKind::Block, type);
+        auto outer_block = std::exchange(m_block, clone);
+        for (std::size_t i = 0; i < m_root.block_stmts(id).size(); i++) {
+            auto stmt = m_root.block_stmts(id)[i];
+            stmt.accept(this);
+        }
+        m_block = outer_block;
+        if (auto value = m_root.expr(id).block_value()) {
+            auto cloned_value = clone_expr(*value);
+            m_root.set_block_value(clone, cloned_value);
+        }
+        return clone;
+    }
+    case hir::ExprKind::Call: {
+        const auto *callee = expr.call_callee();
+        std::vector<hir::ExprId> args(callee->params().size());
+        for (std::size_t i = 0; i < args.size(); i++) {
+            args[i] = clone_expr(m_root.call_args(id)[i]);
+        }
+        return m_root.create_call(location, callee, type, args);
+    }
+    case hir::ExprKind::Constant:
+        return create_constant(location, type, expr.constant_value());
+    case hir::ExprKind::Match:
+        return clone_match(id);
+    case hir::ExprKind::Range: {
+        auto first = clone_expr(expr.binary_lhs());
+        auto last = clone_expr(expr.binary_rhs());
+        auto clone = m_root.create_expr(location, hir::ExprKind::Range, first, last);
+        m_root.set_type(clone, type);
+        return clone;
+    }
+    case hir::ExprKind::Wildcard:
+        return m_root.create_expr(location, hir::ExprKind::Wildcard, type);
+    case hir::ExprKind::Argument:
+    case hir::ExprKind::Var:
+        COEL_ENSURE_NOT_REACHED("Unbound symbol in cloned body");
+    }
+    COEL_ENSURE_NOT_REACHED();
+}
+
+void Cloner::visit(const hir::DeclStmt &decl_stmt) {
+    if (m_value) {
+        return;
+    }
+    auto value = clone_expr(decl_stmt.value());
+    if (constant_value(value)) {
+        // Propagate the constant directly to the uses of the variable.
+        m_map.emplace(decl_stmt.var(), value);
+        return;
+    }
+    const auto location = m_root.location(decl_stmt.var());
+    auto var = m_root.create_expr(location, hir::ExprKind::Var, hir::Type(m_root.type(decl_stmt.var())));
+    m_root.append_stmt(m_block, hir::DeclStmt(var, value));
+    m_map.emplace(decl_stmt.var(), var);
+}
+
+void Cloner::visit(const hir::Function &) {
+    COEL_ENSURE_NOT_REACHED();
+}
+
+void Cloner::visit(const hir::ReturnStmt &return_stmt) {
+    if (m_value) {
+        return;
+    }
+    auto value = clone_expr(return_stmt.value());
+    if (m_returns == Returns::Yield) {
+        // Anything after the first return is unreachable.
+        m_value = value;
+        return;
+    }
+    m_root.append_stmt(m_block, hir::ReturnStmt(value));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Hir.hh>
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+
+// Calls callback with every call in a function, including calls nested in the arguments of other calls. The body is
+// walked with an explicit worklist rather than by recursion, so that deeply nested expressions can't overflow the
+// native stack.
+void for_each_call(const hir::Root &root, const hir::Function &function,
+                   const std::function<void(hir::ExprId)> &callback);
+
+// Clones the statements of a function body into a block, substituting the expressions bound to its parameters and
+// folding any constants which result.
+class Cloner final : public hir::Visitor {
+public:
+    // What to do with the return statements of the cloned body.
+    enum class Returns {
+        // Clone them as return statements of the function the block belongs to.
+        Keep,
+        // Stop cloning at the first one and take its value as the value of the body, e.g. when inlining a call.
+        Yield,
+    };
+
+private:
+    hir::Root &m_root;
+    hir::ExprId m_block;
+    const Returns m_returns;
+    std::unordered_map<hir::ExprId, hir::ExprId> m_map;
+    std::optional<hir::ExprId> m_value;
+
+    std::optional<std::size_t> constant_value(hir::ExprId id) const;
+    std::optional<bool> pattern_matches(hir::ExprId pattern, std::size_t value) const;
+    hir::ExprId clone_match(hir::ExprId id);
+    hir::ExprId clone_expr(hir::ExprId id);
+
+public:
+    Cloner(hir::Root &root, hir::ExprId block, Returns returns) : m_root(root), m_block(block), m_returns(returns) {}
+
+    hir::ExprId create_constant(const SourceLocation &location, const hir::Type &type, std::size_t value);
+    void bind(hir::ExprId from, hir::ExprId to) { m_map.emplace(from, to); }
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+
+    // The value of the first return statement when returns are yielded.
+    std::optional<hir::ExprId> value() const { return m_value; }
+};
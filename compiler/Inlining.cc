@@ -0,0 +1,288 @@
+#include <Inlining.hh>
+
+#include <Hir.hh>
+#include <HirWalker.hh>
+#include <Profile.hh>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct InlineParams {
+    // Maximum cost of a callee body that will be inlined.
+    std::size_t threshold;
+    // Maximum number of times a function may be inlined into its own body.
+    std::size_t recursion_limit;
+    // Maximum nesting depth of inlined bodies at a single call site.
+    std::size_t max_depth;
+    // Maximum total cost of the bodies inlined into a single function.
+    std::size_t growth_limit;
+    // Factor by which the threshold is raised at call sites made at least 1/8th as often as the hottest call site.
+    std::size_t hot_factor;
+};
+
+InlineParams inline_params(unsigned opt_level) {
+    if (opt_level == 1) {
+        return {12, 0, 4, 64, 2};
+    }
+    return {48, 2, 8, 256, 4};
+}
+
+class CostModel final : public hir::Visitor {
+    const hir::Root &m_root;
+    std::size_t m_cost{0};
+    bool m_returns{false};
+
+    void add_expr(hir::ExprId id);
+
+public:
+    explicit CostModel(const hir::Root &root) : m_root(root) {}
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+
+    std::size_t cost() const { return m_cost; }
+    bool returns() const { return m_returns; }
+};
+
+class Inliner final : public hir::Visitor {
+    hir::Root &m_root;
+    const InlineParams m_params;
+    const Profile *const m_profile;
+    const hir::Function *m_function{nullptr};
+    std::vector<const hir::Function *> m_inline_stack;
+    std::vector<InlineRemark> m_remarks;
+    std::size_t m_growth{0};
+
+    bool should_inline(hir::ExprId id, const hir::Function *callee, const CostModel &cost_model) const;
+    void inline_call(hir::ExprId id);
+    void inline_expr(hir::ExprId id);
+
+public:
+    Inliner(hir::Root &root, const InlineParams &params, const Profile *profile)
+        : m_root(root), m_params(params), m_profile(profile) {}
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+
+    std::vector<InlineRemark> &remarks() { return m_remarks; }
+};
+
+void CostModel::add_expr(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    switch (expr.kind()) {
+    case hir::ExprKind::Argument:
+    case hir::ExprKind::Constant:
+    case hir::ExprKind::Wildcard:
+        break;
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub:
+    case hir::ExprKind::Range:
+        m_cost++;
+        add_expr(expr.binary_lhs());
+        add_expr(expr.binary_rhs());
+        break;
+    case hir::ExprKind::Block:
+        for (const auto &stmt : m_root.block_stmts(id)) {
+            stmt.accept(this);
+        }
+        if (auto value = expr.block_value()) {
+            add_expr(*value);
+        }
+        break;
+    case hir::ExprKind::Call:
+        // Account for the call itself and for moving each argument into place.
+        m_cost += 2 + expr.call_callee()->params().size();
+        for (hir::ExprId arg : m_root.call_args(id)) {
+            add_expr(arg);
+        }
+        break;
+    case hir::ExprKind::Match:
+        // Account for the result slot store and load.
+        m_cost += 2;
+        add_expr(expr.match_matchee());
+        for (auto [lhs, rhs] : m_root.match_arms(id)) {
+            // Account for the compare and branch.
+            m_cost += 2;
+            add_expr(lhs);
+            add_expr(rhs);
+        }
+        break;
+    case hir::ExprKind::Var:
+        m_cost++;
+        break;
+    }
+}
+
+void CostModel::visit(const hir::DeclStmt &decl_stmt) {
+    if (!m_returns) {
+        m_cost++;
+        add_expr(decl_stmt.value());
+    }
+}
+
+void CostModel::visit(const hir::Function &function) {
+    for (const auto &stmt : m_root.block_stmts(function.block())) {
+        stmt.accept(this);
+    }
+}
+
+void CostModel::visit(const hir::ReturnStmt &return_stmt) {
+    if (!m_returns) {
+        add_expr(return_stmt.value());
+        m_returns = true;
+    }
+}
+
+bool Inliner::should_inline(hir::ExprId id, const hir::Function *callee, const CostModel &cost_model) const {
+    auto threshold = m_params.threshold;
+    if (m_profile != nullptr) {
+        const auto count = m_profile->call_count(m_root.location(id));
+        if (count == 0) {
+            return false;
+        }
+        if (count * 8 >= m_profile->max_call_count()) {
+            threshold *= m_params.hot_factor;
+        }
+    }
+    if (!cost_model.returns() || cost_model.cost() > threshold) {
+        return false;
+    }
+    if (m_growth + cost_model.cost() > m_params.growth_limit) {
+        return false;
+    }
+    if (m_inline_stack.size() >= m_params.max_depth) {
+        return false;
+    }
+    auto recursion_depth = static_cast<std::size_t>(std::count(m_inline_stack.begin(), m_inline_stack.end(), callee));
+    if (callee == m_function) {
+        recursion_depth++;
+    }
+    return recursion_depth <= m_params.recursion_limit;
+}
+
+void Inliner::inline_call(hir::ExprId id) {
+    const auto *callee = m_root.expr(id).call_callee();
+    CostModel cost_model(m_root);
+    callee->accept(&cost_model);
+    if (!should_inline(id, callee, cost_model)) {
+        return;
+    }
+
+    // The callee body is cloned into a new block that binds the arguments and then yields the callee's return value.
+    // The block is built separately before replacing the call in-place, since the callee may be the current function.
+    const auto location = m_root.location(id);
+    const auto type = m_root.type(id);
+    auto block = m_root.create_expr(location, hir::ExprKind::Block, type);
+    Cloner cloner(m_root, block, Cloner::Returns::Yield);
+    std::size_t binding_count = 0;
+    for (std::size_t i = 0; i < callee->params().size(); i++) {
+        hir::ExprId arg = m_root.call_args(id)[i];
+        hir::ExprId param = callee->params()[i];
+        auto arg_kind = m_root.kind(arg);
+        if (arg_kind == hir::ExprKind::Argument || arg_kind == hir::ExprKind::Constant ||
+            arg_kind == hir::ExprKind::Var) {
+            cloner.bind(param, arg);
+            continue;
+        }
+        const auto arg_location = m_root.location(arg);
+        auto var = m_root.create_expr(arg_location, hir::ExprKind::Var, hir::Type(m_root.type(param)));
+        m_root.append_stmt(block, hir::DeclStmt(var, arg));
+        cloner.bind(param, var);
+        binding_count++;
+    }
+    for (std::size_t i = 0; i < m_root.block_stmts(callee->block()).size(); i++) {
+        auto stmt = m_root.block_stmts(callee->block())[i];
+        stmt.accept(&cloner);
+    }
+    m_root.set_block_value(block, *cloner.value());
+    m_root.replace_expr(id, block);
+    m_remarks.push_back({location, m_function->name(), callee->name(), cost_model.cost()});
+    m_growth += cost_model.cost();
+
+    // Inline into the cloned body, skipping the argument bindings which have already been visited.
+    m_inline_stack.push_back(callee);
+    for (std::size_t i = binding_count; i < m_root.block_stmts(id).size(); i++) {
+        auto stmt = m_root.block_stmts(id)[i];
+        stmt.accept(this);
+    }
+    inline_expr(*m_root.expr(id).block_value());
+    m_inline_stack.pop_back();
+}
+
+void Inliner::inline_expr(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    switch (expr.kind()) {
+    case hir::ExprKind::Argument:
+    case hir::ExprKind::Constant:
+    case hir::ExprKind::Var:
+    case hir::ExprKind::Wildcard:
+        break;
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub:
+    case hir::ExprKind::Range: {
+        auto rhs = expr.binary_rhs();
+        inline_expr(expr.binary_lhs());
+        inline_expr(rhs);
+        break;
+    }
+    case hir::ExprKind::Block: {
+        for (std::size_t i = 0; i < m_root.block_stmts(id).size(); i++) {
+            auto stmt = m_root.block_stmts(id)[i];
+            stmt.accept(this);
+        }
+        if (auto value = m_root.expr(id).block_value()) {
+            inline_expr(*value);
+        }
+        break;
+    }
+    case hir::ExprKind::Call: {
+        const auto arg_count = expr.call_callee()->params().size();
+        for (std::size_t i = 0; i < arg_count; i++) {
+            inline_expr(m_root.call_args(id)[i]);
+        }
+        inline_call(id);
+        break;
+    }
+    case hir::ExprKind::Match: {
+        const auto arm_count = expr.match_arm_count();
+        inline_expr(expr.match_matchee());
+        for (std::size_t i = 0; i < arm_count; i++) {
+            inline_expr(m_root.match_arms(id)[i].first);
+            inline_expr(m_root.match_arms(id)[i].second);
+        }
+        break;
+    }
+    }
+}
+
+void Inliner::visit(const hir::DeclStmt &decl_stmt) {
+    inline_expr(decl_stmt.value());
+}
+
+void Inliner::visit(const hir::Function &function) {
+    m_function = &function;
+    m_growth = 0;
+    inline_expr(function.block());
+}
+
+void Inliner::visit(const hir::ReturnStmt &return_stmt) {
+    inline_expr(return_stmt.value());
+}
+
+} // namespace
+
+std::vector<InlineRemark> inline_hir(hir::Root &root, unsigned opt_level, const Profile *profile) {
+    if (opt_level == 0) {
+        return {};
+    }
+    Inliner inliner(root, inline_params(opt_level), profile);
+    for (const auto *function : root) {
+        function->accept(&inliner);
+    }
+    return std::move(inliner.remarks());
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <SourceLocation.hh>
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class Profile;
+
+namespace hir {
+
+class Root;
+
+} // namespace hir
+
+struct InlineRemark {
+    SourceLocation location;
+    std::string_view caller;
+    std::string_view callee;
+    std::size_t cost;
+};
+
+// Inlines small callees into their call sites. Must be run after analysis, since the inlined bodies take their types
+// from the already-analysed callee. If a profile is given, call sites which were never reached are left alone and the
+// hottest call sites may inline larger callees.
+std::vector<InlineRemark> inline_hir(hir::Root &root, unsigned opt_level, const Profile *profile = nullptr);
@@ -0,0 +1,273 @@
+#include <Interpreter.hh>
+
+#include <Hir.hh>
+#include <Profile.hh>
+
+#include <coel/ir/Types.hh>
+#include <coel/support/Assert.hh>
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+enum class TaskKind {
+    // Evaluate an expression and push its value.
+    Expr,
+    // Run the statement at index of a block.
+    Stmt,
+    Binary,
+    Call,
+    Decl,
+    MatchArm,
+    MatchCompare,
+    // Return the value on top of the value stack from the current frame.
+    Ret,
+};
+
+struct Task {
+    TaskKind kind;
+    hir::ExprId id{0};
+    std::size_t index{0};
+};
+
+struct Frame {
+    std::vector<std::uint64_t> args;
+    std::unordered_map<hir::ExprId, std::uint64_t> vars;
+    std::size_t task_base;
+    std::size_t value_base;
+};
+
+// Like lowering, evaluation uses explicit task and value stacks rather than recursion, so that neither deeply nested
+// expressions nor deep call chains can overflow the native stack.
+class Interpreter final : public hir::Visitor {
+    const hir::Root &m_root;
+    Profile *const m_profile;
+    const CallHandler &m_call_handler;
+    std::vector<Frame> m_frames;
+    std::vector<Task> m_tasks;
+    std::vector<std::uint64_t> m_values;
+
+    std::uint64_t pop_value();
+    std::uint64_t truncate(hir::ExprId id, std::uint64_t value) const;
+    void enter(const hir::Function &function, std::vector<std::uint64_t> &&args);
+    void eval_call(hir::ExprId id);
+    void eval_expr(hir::ExprId id);
+    void eval_match_arm(hir::ExprId id, std::size_t index);
+    void eval_match_compare(hir::ExprId id, std::size_t index);
+    void take_match_arm(hir::ExprId id, std::size_t index);
+    void ret();
+    void run_task(const Task &task);
+
+public:
+    Interpreter(const hir::Root &root, Profile *profile, const CallHandler &call_handler)
+        : m_root(root), m_profile(profile), m_call_handler(call_handler) {}
+
+    std::uint64_t run(const hir::Function &function, std::span<const std::uint64_t> args);
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+};
+
+std::uint64_t Interpreter::pop_value() {
+    auto value = m_values.back();
+    m_values.pop_back();
+    return value;
+}
+
+std::uint64_t Interpreter::truncate(hir::ExprId id, std::uint64_t value) const {
+    const auto bit_width = m_root.type(id).real()->as_non_null<coel::ir::IntegerType>()->bit_width();
+    return bit_width < 64 ? value & ((std::uint64_t(1) << bit_width) - 1) : value;
+}
+
+void Interpreter::enter(const hir::Function &function, std::vector<std::uint64_t> &&args) {
+    m_frames.push_back({std::move(args), {}, m_tasks.size(), m_values.size()});
+    m_tasks.push_back({TaskKind::Ret});
+    m_tasks.push_back({TaskKind::Expr, function.block()});
+}
+
+void Interpreter::eval_call(hir::ExprId id) {
+    const auto *callee = m_root.expr(id).call_callee();
+    std::vector<std::uint64_t> args(callee->params().size());
+    for (auto it = args.rbegin(); it != args.rend(); ++it) {
+        *it = pop_value();
+    }
+    if (m_profile != nullptr) {
+        m_profile->count_call(m_root.location(id));
+    }
+    if (m_call_handler) {
+        if (auto value = m_call_handler(*callee, args)) {
+            m_values.push_back(*value);
+            return;
+        }
+    }
+    enter(*callee, std::move(args));
+}
+
+void Interpreter::eval_expr(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    switch (expr.kind()) {
+    case hir::ExprKind::Argument:
+        m_values.push_back(m_frames.back().args[expr.argument_index()]);
+        break;
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub:
+        m_tasks.push_back({TaskKind::Binary, id});
+        m_tasks.push_back({TaskKind::Expr, expr.binary_rhs()});
+        m_tasks.push_back({TaskKind::Expr, expr.binary_lhs()});
+        break;
+    case hir::ExprKind::Block:
+        // A block without a value, such as a function body which always returns, evaluates to zero.
+        if (auto value = expr.block_value()) {
+            m_tasks.push_back({TaskKind::Expr, *value});
+        } else {
+            m_values.push_back(0);
+        }
+        for (std::size_t i = m_root.block_stmts(id).size(); i > 0; i--) {
+            m_tasks.push_back({TaskKind::Stmt, id, i - 1});
+        }
+        break;
+    case hir::ExprKind::Call:
+        m_tasks.push_back({TaskKind::Call, id});
+        for (std::size_t i = expr.call_callee()->params().size(); i > 0; i--) {
+            m_tasks.push_back({TaskKind::Expr, m_root.call_args(id)[i - 1]});
+        }
+        break;
+    case hir::ExprKind::Constant:
+        m_values.push_back(expr.constant_value());
+        break;
+    case hir::ExprKind::Match:
+        m_tasks.push_back({TaskKind::MatchArm, id, 0});
+        m_tasks.push_back({TaskKind::Expr, expr.match_matchee()});
+        break;
+    case hir::ExprKind::Var:
+        m_values.push_back(m_frames.back().vars.at(id));
+        break;
+    case hir::ExprKind::Range:
+    case hir::ExprKind::Wildcard:
+        COEL_ENSURE_NOT_REACHED("Pattern evaluated as an expression");
+    }
+}
+
+void Interpreter::eval_match_arm(hir::ExprId id, std::size_t index) {
+    // The matchee stays on the value stack until an arm is taken.
+    if (index == m_root.expr(id).match_arm_count()) {
+        // No arm matched, which evaluates to zero as in generated code.
+        m_values.back() = 0;
+        return;
+    }
+    const auto pattern = m_root.match_arms(id)[index].first;
+    switch (m_root.kind(pattern)) {
+    case hir::ExprKind::Wildcard:
+        take_match_arm(id, index);
+        break;
+    case hir::ExprKind::Range: {
+        const auto matchee = m_values.back();
+        const auto [first, last] = *m_root.pattern_values(pattern);
+        if (matchee >= first && matchee <= last) {
+            take_match_arm(id, index);
+        } else {
+            m_tasks.push_back({TaskKind::MatchArm, id, index + 1});
+        }
+        break;
+    }
+    default:
+        m_tasks.push_back({TaskKind::MatchCompare, id, index});
+        m_tasks.push_back({TaskKind::Expr, pattern});
+        break;
+    }
+}
+
+void Interpreter::eval_match_compare(hir::ExprId id, std::size_t index) {
+    auto pattern = pop_value();
+    if (pattern != m_values.back()) {
+        m_tasks.push_back({TaskKind::MatchArm, id, index + 1});
+        return;
+    }
+    take_match_arm(id, index);
+}
+
+void Interpreter::take_match_arm(hir::ExprId id, std::size_t index) {
+    m_values.pop_back();
+    if (m_profile != nullptr) {
+        m_profile->count_arm(m_root.location(id), index);
+    }
+    m_tasks.push_back({TaskKind::Expr, m_root.match_arms(id)[index].second});
+}
+
+void Interpreter::ret() {
+    auto value = pop_value();
+    const auto &frame = m_frames.back();
+    m_tasks.resize(frame.task_base);
+    m_values.resize(frame.value_base);
+    m_frames.pop_back();
+    m_values.push_back(value);
+}
+
+void Interpreter::run_task(const Task &task) {
+    switch (task.kind) {
+    case TaskKind::Expr:
+        eval_expr(task.id);
+        break;
+    case TaskKind::Stmt:
+        m_root.block_stmts(task.id)[task.index].accept(this);
+        break;
+    case TaskKind::Binary: {
+        auto rhs = pop_value();
+        auto lhs = pop_value();
+        auto value = m_root.kind(task.id) == hir::ExprKind::Add ? lhs + rhs : lhs - rhs;
+        m_values.push_back(truncate(task.id, value));
+        break;
+    }
+    case TaskKind::Call:
+        eval_call(task.id);
+        break;
+    case TaskKind::Decl:
+        m_frames.back().vars[task.id] = pop_value();
+        break;
+    case TaskKind::MatchArm:
+        eval_match_arm(task.id, task.index);
+        break;
+    case TaskKind::MatchCompare:
+        eval_match_compare(task.id, task.index);
+        break;
+    case TaskKind::Ret:
+        ret();
+        break;
+    }
+}
+
+std::uint64_t Interpreter::run(const hir::Function &function, std::span<const std::uint64_t> args) {
+    enter(function, {args.begin(), args.end()});
+    while (!m_tasks.empty()) {
+        auto next = m_tasks.back();
+        m_tasks.pop_back();
+        run_task(next);
+    }
+    COEL_ASSERT(m_frames.empty() && m_values.size() == 1);
+    return m_values.back();
+}
+
+void Interpreter::visit(const hir::DeclStmt &decl_stmt) {
+    m_tasks.push_back({TaskKind::Decl, decl_stmt.var()});
+    m_tasks.push_back({TaskKind::Expr, decl_stmt.value()});
+}
+
+void Interpreter::visit(const hir::Function &) {
+    COEL_ENSURE_NOT_REACHED();
+}
+
+void Interpreter::visit(const hir::ReturnStmt &return_stmt) {
+    m_tasks.push_back({TaskKind::Ret});
+    m_tasks.push_back({TaskKind::Expr, return_stmt.value()});
+}
+
+} // namespace
+
+std::uint64_t interpret_hir(const hir::Root &root, const hir::Function &function, std::span<const std::uint64_t> args,
+                            Profile *profile, const CallHandler &call_handler) {
+    Interpreter interpreter(root, profile, call_handler);
+    return interpreter.run(function, args);
+}
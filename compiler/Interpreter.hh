@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+
+class Profile;
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+// Called for every call the interpreter makes. If it returns a value, the call is treated as having returned that value
+// rather than being interpreted.
+using CallHandler =
+    std::function<std::optional<std::uint64_t>(const hir::Function &callee, std::span<const std::uint64_t> args)>;
+
+// Evaluates a function directly from its HIR, which must have been analysed. If a profile is given, every match arm
+// taken and every call made is counted in it.
+std::uint64_t interpret_hir(const hir::Root &root, const hir::Function &function, std::span<const std::uint64_t> args,
+                            Profile *profile, const CallHandler &call_handler = {});
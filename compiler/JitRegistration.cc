@@ -0,0 +1,163 @@
+#include <JitRegistration.hh>
+
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+// The GDB JIT interface. GDB sets a breakpoint in __jit_debug_register_code and reads the descriptor when it is hit.
+extern "C" {
+
+enum JitActions : std::uint32_t {
+    JIT_NOACTION = 0,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN,
+};
+
+struct jit_code_entry {
+    jit_code_entry *next_entry;
+    jit_code_entry *prev_entry;
+    const char *symfile_addr;
+    std::uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+    std::uint32_t version;
+    std::uint32_t action_flag;
+    jit_code_entry *relevant_entry;
+    jit_code_entry *first_entry;
+};
+
+// NOLINTNEXTLINE
+[[gnu::noinline, gnu::used]] void __jit_debug_register_code() {
+    asm volatile("" ::: "memory");
+}
+
+// NOLINTNEXTLINE
+[[gnu::used]] jit_descriptor __jit_debug_descriptor{1, JIT_NOACTION, nullptr, nullptr};
+
+} // extern "C"
+
+namespace {
+
+template <typename T>
+void append(std::string &image, const T &value) {
+    image.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void write_perf_map(std::span<const std::uint8_t> code, const std::vector<JitSymbol> &symbols) {
+    const auto path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    std::unique_ptr<FILE, decltype(&std::fclose)> file(std::fopen(path.c_str(), "a"), &std::fclose);
+    if (!file) {
+        return;
+    }
+    for (const auto &symbol : symbols) {
+        std::fprintf(file.get(), "%lx %zx %s\n", reinterpret_cast<std::uintptr_t>(code.data() + symbol.offset),
+                     symbol.size, symbol.name.c_str());
+    }
+}
+
+// Builds a relocatable ELF object with a .text section placed at the code's address, without any contents, and a
+// symbol table with a function symbol for each of the symbols.
+std::string build_elf_image(std::span<const std::uint8_t> code, const std::vector<JitSymbol> &symbols) {
+    const std::string shstrtab("\0.text\0.symtab\0.strtab\0.shstrtab\0", 33);
+    std::string strtab(1, '\0');
+    std::string symtab;
+    append(symtab, Elf64_Sym{});
+    for (const auto &symbol : symbols) {
+        Elf64_Sym sym{};
+        sym.st_name = static_cast<Elf64_Word>(strtab.size());
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        sym.st_shndx = 1;
+        sym.st_value = symbol.offset;
+        sym.st_size = symbol.size;
+        append(symtab, sym);
+        strtab.append(symbol.name).push_back('\0');
+    }
+
+    // Layout: ELF header, then the string and symbol tables, then the section headers.
+    const auto shstrtab_offset = sizeof(Elf64_Ehdr);
+    const auto strtab_offset = shstrtab_offset + shstrtab.size();
+    const auto symtab_offset = (strtab_offset + strtab.size() + 7) & ~std::size_t(7);
+    const auto section_offset = symtab_offset + symtab.size();
+
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = section_offset;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = 5;
+    header.e_shstrndx = 4;
+
+    std::string image;
+    append(image, header);
+    image.append(shstrtab);
+    image.append(strtab);
+    image.resize(symtab_offset, '\0');
+    image.append(symtab);
+
+    Elf64_Shdr text{};
+    text.sh_name = 1;
+    text.sh_type = SHT_NOBITS;
+    text.sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    text.sh_addr = reinterpret_cast<std::uintptr_t>(code.data());
+    text.sh_size = code.size();
+    text.sh_addralign = 16;
+
+    Elf64_Shdr symtab_header{};
+    symtab_header.sh_name = 7;
+    symtab_header.sh_type = SHT_SYMTAB;
+    symtab_header.sh_offset = symtab_offset;
+    symtab_header.sh_size = symtab.size();
+    symtab_header.sh_link = 3;
+    symtab_header.sh_info = 1;
+    symtab_header.sh_addralign = 8;
+    symtab_header.sh_entsize = sizeof(Elf64_Sym);
+
+    Elf64_Shdr strtab_header{};
+    strtab_header.sh_name = 15;
+    strtab_header.sh_type = SHT_STRTAB;
+    strtab_header.sh_offset = strtab_offset;
+    strtab_header.sh_size = strtab.size();
+    strtab_header.sh_addralign = 1;
+
+    Elf64_Shdr shstrtab_header{};
+    shstrtab_header.sh_name = 23;
+    shstrtab_header.sh_type = SHT_STRTAB;
+    shstrtab_header.sh_offset = shstrtab_offset;
+    shstrtab_header.sh_size = shstrtab.size();
+    shstrtab_header.sh_addralign = 1;
+
+    append(image, Elf64_Shdr{});
+    append(image, text);
+    append(image, symtab_header);
+    append(image, strtab_header);
+    append(image, shstrtab_header);
+    return image;
+}
+
+} // namespace
+
+void register_jit_code(std::span<const std::uint8_t> code, const std::vector<JitSymbol> &symbols) {
+    write_perf_map(code, symbols);
+
+    // The image and its entry must outlive the code, so are never freed.
+    auto *image = new std::string(build_elf_image(code, symbols));
+    auto *entry = new jit_code_entry{__jit_debug_descriptor.first_entry, nullptr, image->data(), image->size()};
+    if (entry->next_entry != nullptr) {
+        entry->next_entry->prev_entry = entry;
+    }
+    __jit_debug_descriptor.first_entry = entry;
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+    __jit_debug_register_code();
+}
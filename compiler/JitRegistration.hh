@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+struct JitSymbol {
+    std::string name;
+    std::size_t offset;
+    std::size_t size;
+};
+
+// Describes JIT'd code to external tools so that addresses within it can be attributed to functions. Symbol offsets are
+// relative to the start of the code. The symbols are appended to /tmp/perf-<pid>.map for perf, and an in-memory ELF
+// image holding them is registered with the GDB JIT interface.
+void register_jit_code(std::span<const std::uint8_t> code, const std::vector<JitSymbol> &symbols);
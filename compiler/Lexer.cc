@@ -11,6 +11,7 @@ Token Lexer::next_token() {
         m_stream.next();
     }
     m_location = m_stream.location();
+    m_token_start = m_stream.position();
     if (!m_stream.has_next()) {
         return TokenKind::Eof;
     }
@@ -21,6 +22,16 @@ Token Lexer::next_token() {
         return TokenKind::Colon;
     case ',':
         return TokenKind::Comma;
+    case '.':
+        if (m_stream.peek() == '.') {
+            m_stream.next();
+            if (m_stream.peek() == '=') {
+                m_stream.next();
+                return TokenKind::DotDotEq;
+            }
+            return TokenKind::DotDot;
+        }
+        break;
     case '=':
         if (m_stream.peek() == '>') {
             m_stream.next();
@@ -44,7 +55,7 @@ Token Lexer::next_token() {
     case '/':
         if (m_stream.peek() == '/') {
             m_stream.next();
-            while (m_stream.peek() != '\n') {
+            while (m_stream.has_next() && m_stream.peek() != '\n') {
                 m_stream.next();
             }
             return next_token();
@@ -66,6 +77,9 @@ Token Lexer::next_token() {
             m_stream.next();
         }
         std::string_view view(start, length);
+        if (view == "_") {
+            return TokenKind::Underscore;
+        }
         if (view == "fn") {
             return TokenKind::KeywordFn;
         }
@@ -106,3 +120,13 @@ const Token &Lexer::peek() {
     }
     return m_peek_token;
 }
+
+CharStream::Position Lexer::mark() {
+    peek();
+    return m_token_start;
+}
+
+void Lexer::seek(const CharStream::Position &position) {
+    m_stream.seek(position);
+    m_peek_ready = false;
+}
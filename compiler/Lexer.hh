@@ -9,6 +9,7 @@
 class Lexer {
     CharStream m_stream;
     SourceLocation m_location{0, 0, {}};
+    CharStream::Position m_token_start{};
     Token m_peek_token{TokenKind::Eof};
     bool m_peek_ready{false};
 
@@ -21,5 +22,9 @@ public:
     Token next();
     const Token &peek();
 
+    // Returns the position of the start of the next token, which can later be returned to with seek.
+    CharStream::Position mark();
+    void seek(const CharStream::Position &position);
+
     const SourceLocation &location() const { return m_location; }
 };
@@ -0,0 +1,239 @@
+#include <Merging.hh>
+
+#include <Hir.hh>
+
+#include <coel/ir/Types.hh>
+#include <coel/support/Assert.hh>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Shape = std::vector<std::size_t>;
+
+struct ShapeHash {
+    std::size_t operator()(const Shape &shape) const {
+        std::size_t hash = shape.size();
+        for (auto token : shape) {
+            hash ^= std::hash<std::size_t>{}(token) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+        }
+        return hash;
+    }
+};
+
+// Flattens a function into a sequence of tokens which is equal for two functions if and only if they are identical up
+// to names, locations and the identity of their locals. Callees are represented by their current class, so that calls
+// to different but identical functions compare equal.
+class ShapeBuilder final : public hir::Visitor {
+    const hir::Root &m_root;
+    const std::unordered_map<const hir::Function *, std::size_t> &m_classes;
+    std::unordered_map<hir::ExprId, std::size_t> m_locals;
+    std::vector<hir::ExprId> m_calls;
+    Shape m_shape;
+
+    void emit(std::size_t token) { m_shape.push_back(token); }
+    void emit_local(hir::ExprId id);
+    void emit_type(const hir::Type &type);
+    void build(hir::ExprId id);
+
+public:
+    ShapeBuilder(const hir::Root &root, const std::unordered_map<const hir::Function *, std::size_t> &classes)
+        : m_root(root), m_classes(classes) {}
+
+    void visit(const hir::DeclStmt &decl_stmt) override;
+    void visit(const hir::Function &function) override;
+    void visit(const hir::ReturnStmt &return_stmt) override;
+
+    const std::vector<hir::ExprId> &calls() const { return m_calls; }
+    Shape &shape() { return m_shape; }
+};
+
+void ShapeBuilder::emit_local(hir::ExprId id) {
+    auto [it, inserted] = m_locals.emplace(id, m_locals.size());
+    emit(it->second);
+}
+
+// Types are emitted by kind and width rather than by address, so that shapes are stable across processes.
+void ShapeBuilder::emit_type(const hir::Type &type) {
+    if (type.is_infer()) {
+        emit(0);
+    } else if (const auto *integer_type = type.real()->as<coel::ir::IntegerType>()) {
+        emit(2 + integer_type->bit_width());
+    } else {
+        COEL_ASSERT(type.real()->as<coel::ir::BoolType>() != nullptr);
+        emit(1);
+    }
+}
+
+void ShapeBuilder::build(hir::ExprId id) {
+    const auto expr = m_root.expr(id);
+    emit(static_cast<std::size_t>(expr.kind()));
+    emit_type(expr.type());
+    switch (expr.kind()) {
+    case hir::ExprKind::Argument:
+        emit(expr.argument_index());
+        break;
+    case hir::ExprKind::Constant:
+        emit(expr.constant_value());
+        break;
+    case hir::ExprKind::Var:
+        emit_local(id);
+        break;
+    case hir::ExprKind::Wildcard:
+        break;
+    case hir::ExprKind::Add:
+    case hir::ExprKind::Sub:
+    case hir::ExprKind::Range:
+        build(expr.binary_lhs());
+        build(expr.binary_rhs());
+        break;
+    case hir::ExprKind::Block: {
+        emit(m_root.block_stmts(id).size());
+        for (const auto &stmt : m_root.block_stmts(id)) {
+            stmt.accept(this);
+        }
+        auto value = expr.block_value();
+        emit(value ? 1 : 0);
+        if (value) {
+            build(*value);
+        }
+        break;
+    }
+    case hir::ExprKind::Call: {
+        const auto *callee = expr.call_callee();
+        m_calls.push_back(id);
+        emit(m_classes.at(callee));
+        for (hir::ExprId arg : m_root.call_args(id)) {
+            build(arg);
+        }
+        break;
+    }
+    case hir::ExprKind::Match:
+        emit(expr.match_arm_count());
+        emit(expr.match_exhaustive() ? 1 : 0);
+        build(expr.match_matchee());
+        for (auto [lhs, rhs] : m_root.match_arms(id)) {
+            build(lhs);
+            build(rhs);
+        }
+        break;
+    }
+}
+
+void ShapeBuilder::visit(const hir::DeclStmt &decl_stmt) {
+    emit(0);
+    emit_local(decl_stmt.var());
+    emit_type(m_root.type(decl_stmt.var()));
+    build(decl_stmt.value());
+}
+
+void ShapeBuilder::visit(const hir::Function &function) {
+    emit(function.params().size());
+    for (hir::ExprId param : function.params()) {
+        emit_type(m_root.type(param));
+    }
+    build(function.block());
+}
+
+void ShapeBuilder::visit(const hir::ReturnStmt &return_stmt) {
+    emit(1);
+    build(return_stmt.value());
+}
+
+} // namespace
+
+std::vector<MergeRemark> merge_functions(hir::Root &root, std::string_view entry, unsigned opt_level) {
+    if (opt_level == 0) {
+        return {};
+    }
+
+    // Partition the functions into classes of identical functions. Every function starts off in the same class, and
+    // classes are split by shape until no more splits happen. Since a shape includes the classes of its callees, this
+    // also finds identical (mutually) recursive functions.
+    std::vector<const hir::Function *> functions;
+    std::unordered_map<const hir::Function *, std::size_t> classes;
+    for (const auto *function : root) {
+        functions.push_back(function);
+        classes.emplace(function, 0);
+    }
+    std::vector<std::vector<hir::ExprId>> calls(functions.size());
+    std::size_t class_count = 1;
+    while (true) {
+        std::unordered_map<Shape, std::size_t, ShapeHash> shape_classes;
+        std::vector<std::size_t> new_classes;
+        for (std::size_t i = 0; i < functions.size(); i++) {
+            ShapeBuilder builder(root, classes);
+            functions[i]->accept(&builder);
+            calls[i] = builder.calls();
+
+            // Keep the old class in the shape so that classes are only ever split.
+            auto &shape = builder.shape();
+            shape.push_back(classes.at(functions[i]));
+            auto [it, inserted] = shape_classes.emplace(std::move(shape), shape_classes.size());
+            new_classes.push_back(it->second);
+        }
+        for (std::size_t i = 0; i < functions.size(); i++) {
+            classes[functions[i]] = new_classes[i];
+        }
+        if (shape_classes.size() == class_count) {
+            break;
+        }
+        class_count = shape_classes.size();
+    }
+
+    // Pick the function each class is merged into, preferring the entry function.
+    std::vector<const hir::Function *> targets(class_count, nullptr);
+    for (const auto *function : functions) {
+        auto &target = targets[classes.at(function)];
+        if (target == nullptr || function->name() == entry) {
+            target = function;
+        }
+    }
+
+    std::vector<MergeRemark> remarks;
+    for (const auto *function : functions) {
+        const auto *target = targets[classes.at(function)];
+        if (target != function) {
+            remarks.push_back({function, target});
+        }
+    }
+    if (remarks.empty()) {
+        return {};
+    }
+
+    // Redirect calls to the merged functions, which leaves them unreachable.
+    for (const auto &function_calls : calls) {
+        for (hir::ExprId id : function_calls) {
+            const auto call = root.expr(id);
+            const auto *target = targets[classes.at(call.call_callee())];
+            if (target == call.call_callee()) {
+                continue;
+            }
+            const auto location = call.location();
+            const auto type = call.type();
+            auto redirected = root.create_call(location, target, type, root.call_args(id));
+            root.replace_expr(id, redirected);
+        }
+    }
+    return remarks;
+}
+
+std::unordered_map<const hir::Function *, std::size_t> hash_functions(const hir::Root &root) {
+    std::unordered_map<const hir::Function *, std::size_t> names;
+    for (const auto *function : root) {
+        names.emplace(function, std::hash<std::string_view>{}(function->name()));
+    }
+    std::unordered_map<const hir::Function *, std::size_t> hashes;
+    for (const auto *function : root) {
+        ShapeBuilder builder(root, names);
+        function->accept(&builder);
+        hashes.emplace(function, ShapeHash{}(builder.shape()));
+    }
+    return hashes;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+struct MergeRemark {
+    const hir::Function *function;
+    const hir::Function *target;
+};
+
+// Folds functions that are structurally identical, ignoring names and locations, into a single body by rewriting every
+// call to a redundant function into a call to the kept one. The entry function is always the one kept from its group.
+// Must be run after analysis.
+std::vector<MergeRemark> merge_functions(hir::Root &root, std::string_view entry, unsigned opt_level);
+
+// Hashes the content of each function, ignoring its name and any locations and local identities within it. Callees are
+// hashed by name, so a function's hash only changes if the function itself changes.
+std::unordered_map<const hir::Function *, std::size_t> hash_functions(const hir::Root &root);
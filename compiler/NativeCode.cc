@@ -0,0 +1,33 @@
+#include <NativeCode.hh>
+
+#include <CallGraph.hh>
+#include <Hir.hh>
+#include <HirLowering.hh>
+
+#include <coel/codegen/Context.hh>
+#include <coel/codegen/RegisterAllocator.hh>
+#include <coel/x86/Backend.hh>
+#include <coel/x86/Legaliser.hh>
+
+#include <cstring>
+#include <sys/mman.h>
+
+std::optional<NativeCode> compile_native(const hir::Root &root, const hir::Function &function) {
+    // Every callee must be in the same unit, so compile everything reachable from the function with it as the entry.
+    // Only the reachable functions are visited, so that compiling doesn't slow down with the size of the program.
+    auto unit = lower_hir(root, reachable_functions(root, function));
+    coel::codegen::Context context(unit);
+    coel::x86::legalise(context);
+    coel::codegen::register_allocate(context);
+    auto compiled = coel::x86::compile(unit);
+    auto [entry, encoded] = coel::x86::encode(compiled, unit.find_function(function.name()));
+    auto *code_region =
+        // NOLINTNEXTLINE
+        mmap(nullptr, encoded.size(), PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code_region == MAP_FAILED) {
+        return std::nullopt;
+    }
+    memcpy(code_region, encoded.data(), encoded.size());
+    auto *code = reinterpret_cast<NativeFunction>(static_cast<std::uint8_t *>(code_region) + entry);
+    return NativeCode{code, encoded.size()};
+}
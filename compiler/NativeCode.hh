@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+// The number of integer arguments passed in registers by the System V calling convention. Compiled functions are
+// always called with this many arguments, with any unused ones being ignored by the callee.
+constexpr std::size_t k_register_arg_count = 6;
+
+using NativeFunction = std::uint64_t (*)(std::uint64_t, std::uint64_t, std::uint64_t, std::uint64_t, std::uint64_t,
+                                         std::uint64_t);
+
+struct NativeCode {
+    NativeFunction entry;
+    std::size_t size;
+};
+
+// Compiles function along with every function it can reach, with function as the entry, into newly mapped executable
+// memory. Returns std::nullopt if the memory couldn't be mapped.
+std::optional<NativeCode> compile_native(const hir::Root &root, const hir::Function &function);
@@ -1,19 +1,14 @@
 #pragma once
 
 #include <Ast.hh>
-#include <Token.hh>
 
 #include <memory>
-#include <optional>
 
 class Lexer;
 
 class Parser {
     Lexer &m_lexer;
 
-    std::optional<Token> consume(TokenKind kind);
-    Token expect(TokenKind kind);
-
     std::unique_ptr<ast::CallExpr> parse_call_expr(const SourceLocation &location, std::unique_ptr<ast::Symbol> &&name);
     std::unique_ptr<ast::MatchExpr> parse_match_expr();
     std::unique_ptr<ast::Node> parse_expr();
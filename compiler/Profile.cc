@@ -0,0 +1,140 @@
+#include <Profile.hh>
+
+#include <Hir.hh>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <string_view>
+#include <unordered_set>
+
+std::optional<Profile> Profile::read(const char *path) {
+    std::unique_ptr<FILE, decltype(&std::fclose)> file(std::fopen(path, "r"), &std::fclose);
+    if (!file) {
+        return std::nullopt;
+    }
+    Profile profile;
+    char kind[8];
+    std::size_t line = 0;
+    std::size_t column = 0;
+    while (std::fscanf(file.get(), "%7s %zu %zu", kind, &line, &column) == 3) {
+        std::size_t index = 0;
+        std::uint64_t count = 0;
+        if (std::string_view(kind) == "arm" && std::fscanf(file.get(), "%zu %lu", &index, &count) == 2) {
+            profile.m_arm_counts[{line, column, index}] = count;
+        } else if (std::string_view(kind) == "call" && std::fscanf(file.get(), "%lu", &count) == 1) {
+            profile.m_call_counts[{line, column}] = count;
+            profile.m_max_call_count = std::max(profile.m_max_call_count, count);
+        } else {
+            return std::nullopt;
+        }
+    }
+    if (std::feof(file.get()) == 0) {
+        return std::nullopt;
+    }
+    return profile;
+}
+
+bool Profile::write(const char *path) const {
+    std::unique_ptr<FILE, decltype(&std::fclose)> file(std::fopen(path, "w"), &std::fclose);
+    if (!file) {
+        return false;
+    }
+    for (const auto &[key, count] : m_arm_counts) {
+        const auto &[line, column, index] = key;
+        std::fprintf(file.get(), "arm %zu %zu %zu %lu\n", line, column, index, count);
+    }
+    for (const auto &[key, count] : m_call_counts) {
+        std::fprintf(file.get(), "call %zu %zu %lu\n", key.first, key.second, count);
+    }
+    return std::ferror(file.get()) == 0;
+}
+
+void Profile::count_arm(const SourceLocation &match_location, std::size_t index) {
+    m_arm_counts[{match_location.line(), match_location.column(), index}]++;
+}
+
+void Profile::count_call(const SourceLocation &location) {
+    auto &count = m_call_counts[{location.line(), location.column()}];
+    m_max_call_count = std::max(m_max_call_count, ++count);
+}
+
+std::uint64_t Profile::arm_count(const SourceLocation &match_location, std::size_t index) const {
+    auto it = m_arm_counts.find({match_location.line(), match_location.column(), index});
+    return it != m_arm_counts.end() ? it->second : 0;
+}
+
+std::uint64_t Profile::call_count(const SourceLocation &location) const {
+    auto it = m_call_counts.find({location.line(), location.column()});
+    return it != m_call_counts.end() ? it->second : 0;
+}
+
+namespace {
+
+// Returns how many of the arms, in descending order of count, should be tested one at a time. Testing an arm first
+// costs one extra comparison for every arm after it, whereas a binary search costs about one per level, so an arm is
+// only worth testing first if it's taken more often than that.
+std::size_t hot_arm_count(const Profile &profile, const SourceLocation &location, std::span<const std::size_t> order) {
+    std::uint64_t remaining = 0;
+    for (auto index : order) {
+        remaining += profile.arm_count(location, index);
+    }
+    std::size_t hot = 0;
+    for (; hot < order.size(); hot++) {
+        const auto count = profile.arm_count(location, order[hot]);
+        if (count * std::bit_width(order.size() - hot) <= remaining) {
+            break;
+        }
+        remaining -= count;
+    }
+    return hot;
+}
+
+} // namespace
+
+std::vector<SourceLocation> reorder_match_arms(hir::Root &root, const Profile &profile) {
+    std::vector<SourceLocation> reordered;
+    std::vector<std::size_t> order;
+    std::vector<std::pair<hir::ExprId, hir::ExprId>> arms;
+    for (hir::ExprId id = 0; id < root.expr_count(); id++) {
+        if (root.kind(id) != hir::ExprKind::Match) {
+            continue;
+        }
+        const auto match_arms = root.match_arms(id);
+        // A default arm has to stay last, but the arms before it can still be reordered.
+        auto reorderable = match_arms.size();
+        if (reorderable != 0 && root.kind(match_arms.back().first) == hir::ExprKind::Wildcard) {
+            reorderable--;
+        }
+        std::unordered_set<std::size_t> patterns;
+        bool distinct = std::all_of(match_arms.begin(), match_arms.begin() + reorderable, [&](const auto &arm) {
+            const auto pattern = root.expr(arm.first);
+            return pattern.kind() == hir::ExprKind::Constant && patterns.insert(pattern.constant_value()).second;
+        });
+        if (!distinct) {
+            continue;
+        }
+
+        const auto &location = root.location(id);
+        order.resize(match_arms.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(reorderable),
+                         [&](std::size_t lhs, std::size_t rhs) {
+                             return profile.arm_count(location, lhs) > profile.arm_count(location, rhs);
+                         });
+        root.set_match_hot_arm_count(id, hot_arm_count(profile, location, {order.data(), reorderable}));
+        if (std::is_sorted(order.begin(), order.end())) {
+            continue;
+        }
+        arms.clear();
+        for (auto index : order) {
+            arms.push_back(match_arms[index]);
+        }
+        root.set_match_arms(id, arms);
+        reordered.push_back(location);
+    }
+    return reordered;
+}
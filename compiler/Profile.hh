@@ -0,0 +1,45 @@
+#pragma once
+
+#include <SourceLocation.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace hir {
+
+class Root;
+
+} // namespace hir
+
+// Execution counts of match arms and call sites, gathered by an instrumented run. Counts are keyed by source position
+// rather than by HIR id so that a profile can be read back by a later compilation of the same source.
+class Profile {
+    // Keyed by the line and column of the match and the index of the arm, in source order.
+    std::map<std::tuple<std::size_t, std::size_t, std::size_t>, std::uint64_t> m_arm_counts;
+    // Keyed by the line and column of the call.
+    std::map<std::pair<std::size_t, std::size_t>, std::uint64_t> m_call_counts;
+    std::uint64_t m_max_call_count{0};
+
+public:
+    static std::optional<Profile> read(const char *path);
+    bool write(const char *path) const;
+
+    void count_arm(const SourceLocation &match_location, std::size_t index);
+    void count_call(const SourceLocation &location);
+
+    std::uint64_t arm_count(const SourceLocation &match_location, std::size_t index) const;
+    std::uint64_t call_count(const SourceLocation &location) const;
+    std::uint64_t max_call_count() const { return m_max_call_count; }
+};
+
+// Reorders the arms of each match so that the most frequently taken arms are tested first. Only matches whose patterns
+// are distinct constants, optionally followed by a default arm which is kept last, are reordered, since the first
+// matching arm must otherwise be kept the same. The leading arms which are taken often enough are marked as hot, so
+// that they are tested one at a time before any binary search over the rest. Must be run after analysis, and before
+// any pass which clones matches. Returns the locations of the reordered matches.
+std::vector<SourceLocation> reorder_match_arms(hir::Root &root, const Profile &profile);
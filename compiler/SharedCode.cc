@@ -0,0 +1,187 @@
+#include <SharedCode.hh>
+
+#include <Hir.hh>
+#include <Merging.hh>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Bumped whenever code generation or the layout of the cache changes, so that stale code is never picked up.
+constexpr std::uint64_t k_format_version = 1;
+
+// The most code kept in the cache for each user. Once it's exceeded, the least recently used programs are evicted.
+constexpr std::size_t k_max_cache_size = 64 * 1024 * 1024;
+
+// The age in seconds after which a temporary file is assumed to be left over from a process which died while
+// publishing.
+constexpr std::time_t k_temp_file_lifetime = 60;
+
+struct Header {
+    std::uint64_t version;
+    std::uint64_t entry;
+    std::uint64_t size;
+};
+
+// Code is kept in tmpfs so that it lives in the page cache, where every mapping of it shares the same pages. Since
+// /dev/shm is writable by everyone, the cache is split per user, and only files owned by this user are ever mapped.
+std::string cache_prefix() {
+    return fmt::format("kodo-{}-", geteuid());
+}
+
+std::string cache_path(std::uint64_t key) {
+    return fmt::format("/dev/shm/{}{:016x}", cache_prefix(), key);
+}
+
+std::optional<SharedCode> map_code(int fd) {
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(Header)) {
+        return std::nullopt;
+    }
+    // Refuse to execute anything which another user could have planted or could still modify.
+    if (!S_ISREG(status.st_mode) || status.st_uid != geteuid() || (status.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        return std::nullopt;
+    }
+    const auto file_size = static_cast<std::size_t>(status.st_size);
+    // NOLINTNEXTLINE
+    auto *mapping = mmap(nullptr, file_size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return std::nullopt;
+    }
+    const auto *header = static_cast<const Header *>(mapping);
+    if (header->version != k_format_version || sizeof(Header) + header->size != file_size ||
+        header->entry >= header->size) {
+        munmap(mapping, file_size);
+        return std::nullopt;
+    }
+    return SharedCode{static_cast<const std::uint8_t *>(mapping) + sizeof(Header), header->size, header->entry};
+}
+
+bool has_current_version(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    Header header{};
+    const bool current = read(fd, &header, sizeof(Header)) == sizeof(Header) && header.version == k_format_version;
+    close(fd);
+    return current;
+}
+
+// Removes this user's files which are left over from older versions or from processes which died while publishing,
+// and then the least recently used code until the rest fits in k_max_cache_size. Processes which still have evicted
+// code mapped keep running it.
+void evict_shared_code() {
+    struct CachedFile {
+        std::string path;
+        std::time_t last_used;
+        std::size_t size;
+    };
+    auto *directory = opendir("/dev/shm");
+    if (directory == nullptr) {
+        return;
+    }
+    const auto prefix = cache_prefix();
+    const auto now = std::time(nullptr);
+    std::vector<CachedFile> files;
+    std::size_t total_size = 0;
+    while (const auto *directory_entry = readdir(directory)) {
+        std::string_view name(directory_entry->d_name);
+        if (!name.starts_with(prefix)) {
+            continue;
+        }
+        auto path = fmt::format("/dev/shm/{}", name);
+        struct stat status {};
+        if (lstat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode) || status.st_uid != geteuid()) {
+            continue;
+        }
+        // Only temporary files have a suffix after the key.
+        if (name.find('.') != std::string_view::npos) {
+            if (now - status.st_mtime > k_temp_file_lifetime) {
+                unlink(path.c_str());
+            }
+            continue;
+        }
+        if (!has_current_version(path)) {
+            unlink(path.c_str());
+            continue;
+        }
+        const auto size = static_cast<std::size_t>(status.st_size);
+        files.push_back({std::move(path), status.st_mtime, size});
+        total_size += size;
+    }
+    closedir(directory);
+
+    std::sort(files.begin(), files.end(), [](const CachedFile &lhs, const CachedFile &rhs) {
+        return lhs.last_used < rhs.last_used;
+    });
+    for (auto it = files.begin(); it != files.end() && total_size > k_max_cache_size; ++it) {
+        unlink(it->path.c_str());
+        total_size -= it->size;
+    }
+}
+
+} // namespace
+
+std::uint64_t hash_program(const hir::Root &root, const std::vector<const hir::Function *> &functions) {
+    const auto hashes = hash_functions(root);
+    std::uint64_t hash = k_format_version;
+    for (const auto *function : functions) {
+        for (std::uint64_t part : {std::hash<std::string_view>{}(function->name()), hashes.at(function)}) {
+            hash ^= part + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+        }
+    }
+    return hash;
+}
+
+std::optional<SharedCode> find_shared_code(std::uint64_t key) {
+    const int fd = open(cache_path(key).c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    auto code = map_code(fd);
+    if (code) {
+        // Mark the code as recently used, so that it's evicted last.
+        futimens(fd, nullptr);
+    }
+    close(fd);
+    return code;
+}
+
+std::optional<SharedCode> publish_shared_code(std::uint64_t key, std::span<const std::uint8_t> code,
+                                              std::size_t entry) {
+    // Write to a file private to this process first and then rename it into place, so that other processes never see
+    // partially written code. The file must be newly created, so that a symlink or file planted at the temporary path
+    // is never written through.
+    const auto path = cache_path(key);
+    const auto temp_path = fmt::format("{}.{}", path, getpid());
+    const int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    const Header header{k_format_version, entry, code.size()};
+    bool written = write(fd, &header, sizeof(Header)) == sizeof(Header) &&
+                   write(fd, code.data(), code.size()) == static_cast<ssize_t>(code.size());
+    if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        close(fd);
+        return std::nullopt;
+    }
+    auto shared = map_code(fd);
+    close(fd);
+    evict_shared_code();
+    return shared;
+}
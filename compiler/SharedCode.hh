@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+// Code mapped read and execute from a host-wide cache in shared memory, so that every process running the same program
+// shares the same physical pages.
+struct SharedCode {
+    const std::uint8_t *code;
+    std::size_t size;
+    std::size_t entry;
+};
+
+// Hashes the given functions, in order, such that any change to them which could change the compiled code changes the
+// hash.
+std::uint64_t hash_program(const hir::Root &root, const std::vector<const hir::Function *> &functions);
+
+// Maps the code published under key by any process, if there is any.
+std::optional<SharedCode> find_shared_code(std::uint64_t key);
+
+// Publishes code under key and maps it. If another process publishes the same key at the same time, either copy may
+// end up being used, since they are identical. Publishing also evicts old code once the cache grows too large.
+std::optional<SharedCode> publish_shared_code(std::uint64_t key, std::span<const std::uint8_t> code, std::size_t entry);
@@ -0,0 +1,216 @@
+#include <Specialisation.hh>
+
+#include <Hir.hh>
+#include <HirWalker.hh>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct SpecialisationParams {
+    // Minimum number of call sites sharing a constant argument pattern before a clone is made.
+    std::size_t min_call_count;
+    // Maximum number of clones made across the whole program.
+    std::size_t max_clones;
+};
+
+SpecialisationParams specialisation_params(unsigned opt_level) {
+    if (opt_level == 1) {
+        return {2, 8};
+    }
+    return {2, 32};
+}
+
+// The constant value of each argument of a call, or std::nullopt if the argument isn't constant.
+using ArgPattern = std::vector<std::optional<std::size_t>>;
+
+class Specialiser {
+    hir::Root &m_root;
+    const SpecialisationParams m_params;
+    std::map<std::pair<const hir::Function *, ArgPattern>, hir::Function *> m_clones;
+    std::vector<SpecialisationRemark> m_remarks;
+
+    std::vector<hir::ExprId> constant_call_sites(const hir::Function &function) const;
+    ArgPattern arg_pattern(hir::ExprId id) const;
+    hir::Function *create_clone(const hir::Function *callee, const ArgPattern &pattern);
+    void rewrite_call(hir::ExprId id, hir::Function *clone, const ArgPattern &pattern);
+
+public:
+    Specialiser(hir::Root &root, const SpecialisationParams &params) : m_root(root), m_params(params) {}
+
+    void run();
+
+    std::vector<SpecialisationRemark> &remarks() { return m_remarks; }
+};
+
+// Collects calls which pass at least one constant argument.
+std::vector<hir::ExprId> Specialiser::constant_call_sites(const hir::Function &function) const {
+    std::vector<hir::ExprId> call_sites;
+    for_each_call(m_root, function, [&](hir::ExprId id) {
+        const auto args = m_root.call_args(id);
+        if (std::any_of(args.begin(), args.end(), [&](hir::ExprId arg) {
+                return m_root.kind(arg) == hir::ExprKind::Constant;
+            })) {
+            call_sites.push_back(id);
+        }
+    });
+    return call_sites;
+}
+
+ArgPattern Specialiser::arg_pattern(hir::ExprId id) const {
+    ArgPattern pattern;
+    for (hir::ExprId arg_id : m_root.call_args(id)) {
+        const auto arg = m_root.expr(arg_id);
+        if (arg.kind() == hir::ExprKind::Constant) {
+            pattern.emplace_back(arg.constant_value());
+        } else {
+            pattern.emplace_back(std::nullopt);
+        }
+    }
+    return pattern;
+}
+
+hir::Function *Specialiser::create_clone(const hir::Function *callee, const ArgPattern &pattern) {
+    std::vector<hir::ExprId> params;
+    for (std::size_t i = 0; i < pattern.size(); i++) {
+        if (!pattern[i]) {
+            hir::ExprId param = callee->params()[i];
+            const auto location = m_root.location(param);
+            const auto index = params.size();
+            params.push_back(
+                m_root.create_expr(location, hir::ExprKind::Argument, hir::Type(m_root.type(param)), index));
+        }
+    }
+
+    auto *clone = m_root.append_function(fmt::format("{}.spec{}", callee->name(), m_clones.size()), std::move(params));
+    const auto location = m_root.location(callee->block());
+    clone->set_block(m_root.create_expr(location, hir::ExprKind::Block, hir::Type(m_root.type(callee->block()))));
+
+    Cloner cloner(m_root, clone->block(), Cloner::Returns::Keep);
+    for (std::size_t i = 0, param_index = 0; i < pattern.size(); i++) {
+        hir::ExprId param = callee->params()[i];
+        if (!pattern[i]) {
+            cloner.bind(param, clone->params()[param_index++]);
+            continue;
+        }
+        const auto param_location = m_root.location(param);
+        cloner.bind(param, cloner.create_constant(param_location, hir::Type(m_root.type(param)), *pattern[i]));
+    }
+    for (std::size_t i = 0; i < m_root.block_stmts(callee->block()).size(); i++) {
+        auto stmt = m_root.block_stmts(callee->block())[i];
+        stmt.accept(&cloner);
+    }
+    return clone;
+}
+
+void Specialiser::rewrite_call(hir::ExprId id, hir::Function *clone, const ArgPattern &pattern) {
+    const auto location = m_root.location(id);
+    const auto type = m_root.type(id);
+    std::vector<hir::ExprId> args;
+    for (std::size_t i = 0; i < pattern.size(); i++) {
+        if (!pattern[i]) {
+            args.push_back(m_root.call_args(id)[i]);
+        }
+    }
+    m_root.replace_expr(id, m_root.create_call(location, clone, type, args));
+}
+
+void Specialiser::run() {
+    std::vector<hir::ExprId> all_call_sites;
+    for (const auto *function : m_root) {
+        auto function_call_sites = constant_call_sites(*function);
+        all_call_sites.insert(all_call_sites.end(), function_call_sites.begin(), function_call_sites.end());
+    }
+
+    // Only specialise on the constant arguments that recur at the same position across calls to the same callee, so
+    // that e.g. add(x, 20) and add(y, 20) share a clone even though x and y differ.
+    std::map<std::tuple<const hir::Function *, std::size_t, std::size_t>, std::size_t> arg_counts;
+    for (hir::ExprId id : all_call_sites) {
+        auto pattern = arg_pattern(id);
+        for (std::size_t i = 0; i < pattern.size(); i++) {
+            if (pattern[i]) {
+                arg_counts[{m_root.expr(id).call_callee(), i, *pattern[i]}]++;
+            }
+        }
+    }
+    std::map<std::pair<const hir::Function *, ArgPattern>, std::vector<hir::ExprId>> call_sites;
+    for (hir::ExprId id : all_call_sites) {
+        const auto *callee = m_root.expr(id).call_callee();
+        auto pattern = arg_pattern(id);
+        bool has_recurring_arg = false;
+        for (std::size_t i = 0; i < pattern.size(); i++) {
+            if (pattern[i] && arg_counts.at({callee, i, *pattern[i]}) < m_params.min_call_count) {
+                pattern[i] = std::nullopt;
+            }
+            has_recurring_arg |= pattern[i].has_value();
+        }
+        if (has_recurring_arg) {
+            call_sites[{callee, std::move(pattern)}].push_back(id);
+        }
+    }
+
+    // Give the most frequent patterns priority for the limited number of clones.
+    std::vector<std::pair<const std::pair<const hir::Function *, ArgPattern>, std::vector<hir::ExprId>> *> patterns;
+    for (auto &entry : call_sites) {
+        patterns.push_back(&entry);
+    }
+    std::stable_sort(patterns.begin(), patterns.end(), [](const auto *lhs, const auto *rhs) {
+        return lhs->second.size() > rhs->second.size();
+    });
+
+    std::vector<hir::Function *> clones;
+    for (const auto *entry : patterns) {
+        const auto &[key, ids] = *entry;
+        if (ids.size() < m_params.min_call_count || clones.size() == m_params.max_clones) {
+            break;
+        }
+        const auto &[callee, pattern] = key;
+        auto *clone = create_clone(callee, pattern);
+        m_clones.emplace(key, clone);
+        clones.push_back(clone);
+        for (hir::ExprId id : ids) {
+            rewrite_call(id, clone, pattern);
+        }
+        m_remarks.push_back({callee->name(), clone->name(), ids.size()});
+    }
+
+    // Folding may have produced further calls within the clones that match an existing clone, such as a recursive call
+    // with the same constant arguments.
+    for (auto *clone : clones) {
+        for (hir::ExprId id : constant_call_sites(*clone)) {
+            auto pattern = arg_pattern(id);
+            for (const auto &[key, existing] : m_clones) {
+                const auto &[callee, clone_pattern] = key;
+                if (callee != m_root.expr(id).call_callee()) {
+                    continue;
+                }
+                bool compatible = true;
+                for (std::size_t i = 0; i < pattern.size(); i++) {
+                    compatible &= !clone_pattern[i] || clone_pattern[i] == pattern[i];
+                }
+                if (compatible) {
+                    rewrite_call(id, existing, clone_pattern);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+std::vector<SpecialisationRemark> specialise_hir(hir::Root &root, unsigned opt_level) {
+    if (opt_level == 0) {
+        return {};
+    }
+    Specialiser specialiser(root, specialisation_params(opt_level));
+    specialiser.run();
+    return std::move(specialiser.remarks());
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace hir {
+
+class Root;
+
+} // namespace hir
+
+struct SpecialisationRemark {
+    std::string_view callee;
+    std::string_view clone;
+    std::size_t call_count;
+};
+
+// Clones functions that are repeatedly called with the same constant arguments, folds the constants into the clone and
+// rewrites the call sites to call the clone instead. Must be run after analysis.
+std::vector<SpecialisationRemark> specialise_hir(hir::Root &root, unsigned opt_level);
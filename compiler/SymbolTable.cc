@@ -0,0 +1,74 @@
+#include <SymbolTable.hh>
+
+#include <Diagnostic.hh>
+
+#include <coel/support/Assert.hh>
+
+#include <functional>
+
+std::uint32_t SymbolTable::find_slot(std::string_view name) const {
+    const auto mask = m_slots.size() - 1;
+    auto index = std::hash<std::string_view>{}(name) & mask;
+    while (m_slots[index].used && m_slots[index].name != name) {
+        index = (index + 1) & mask;
+    }
+    return static_cast<std::uint32_t>(index);
+}
+
+void SymbolTable::grow() {
+    auto old_slots = std::exchange(m_slots, std::vector<Slot>(m_slots.size() * 2));
+    for (const auto &slot : old_slots) {
+        if (slot.used) {
+            m_slots[find_slot(slot.name)] = slot;
+        }
+    }
+    for (auto &binding : m_bindings) {
+        binding.slot = find_slot(old_slots[binding.slot].name);
+    }
+}
+
+void SymbolTable::leave_scope() {
+    for (auto i = m_bindings.size(); i > m_scopes.back().second; i--) {
+        const auto &binding = m_bindings[i - 1];
+        m_slots[binding.slot].binding = binding.shadowed;
+    }
+    m_bindings.resize(m_scopes.back().second);
+    m_scopes.pop_back();
+}
+
+std::optional<hir::ExprId> SymbolTable::find_symbol(std::string_view name) const {
+    const auto &slot = m_slots[find_slot(name)];
+    if (slot.binding == k_no_binding) {
+        return std::nullopt;
+    }
+    return m_bindings[slot.binding].id;
+}
+
+hir::ExprId SymbolTable::lookup_symbol(const SourceLocation &location, std::string_view name) const {
+    if (auto symbol = find_symbol(name)) {
+        return *symbol;
+    }
+    Diagnostic(location, "attempted use of undeclared symbol '{}'", name);
+    COEL_ENSURE_NOT_REACHED();
+}
+
+void SymbolTable::put_symbol(const SourceLocation &location, std::string_view name, hir::ExprId id) {
+    auto index = find_slot(name);
+    if (m_slots[index].binding != k_no_binding) {
+        Diagnostic diagnostic(location, "attempted redeclaration of symbol '{}'", name);
+        diagnostic.add_note(m_root.location(m_bindings[m_slots[index].binding].id), "symbol originally declared here");
+    }
+    if (!m_slots[index].used) {
+        // Keep the load factor at or below a half.
+        if ((m_used_count + 1) * 2 > m_slots.size()) {
+            grow();
+            index = find_slot(name);
+        }
+        m_slots[index].name = name;
+        m_slots[index].used = true;
+        m_used_count++;
+    }
+    auto &slot = m_slots[index];
+    m_bindings.push_back({id, index, slot.binding});
+    slot.binding = static_cast<std::uint32_t>(m_bindings.size() - 1);
+}
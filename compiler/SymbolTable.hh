@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Hir.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class ScopeKind {
+    Block,
+    Function,
+    Root,
+};
+
+// A flat symbol table shared by all scopes. Each name maps, via an open-addressing table, to the most recent of its
+// bindings, with each binding linking to the one it shadows. Bindings are pushed onto a single stack which doubles as
+// an undo log, so leaving a scope just pops its bindings and restores whatever they shadowed.
+class SymbolTable {
+    static constexpr std::uint32_t k_no_binding = UINT32_MAX;
+
+    struct Slot {
+        std::string_view name;
+        std::uint32_t binding{k_no_binding};
+        bool used{false};
+    };
+
+    struct Binding {
+        hir::ExprId id;
+        std::uint32_t slot;
+        std::uint32_t shadowed;
+    };
+
+    const hir::Root &m_root;
+    std::vector<Slot> m_slots;
+    std::size_t m_used_count{0};
+    std::vector<Binding> m_bindings;
+    std::vector<std::pair<ScopeKind, std::size_t>> m_scopes;
+
+    std::uint32_t find_slot(std::string_view name) const;
+    void grow();
+
+public:
+    explicit SymbolTable(const hir::Root &root) : m_root(root), m_slots(64) {}
+
+    void enter_scope(ScopeKind kind) { m_scopes.emplace_back(kind, m_bindings.size()); }
+    void leave_scope();
+
+    std::optional<hir::ExprId> find_symbol(std::string_view name) const;
+    hir::ExprId lookup_symbol(const SourceLocation &location, std::string_view name) const;
+    void put_symbol(const SourceLocation &location, std::string_view name, hir::ExprId id);
+
+    ScopeKind parent_kind() const { return m_scopes[m_scopes.size() - 2].first; }
+};
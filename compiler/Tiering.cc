@@ -0,0 +1,122 @@
+#include <Tiering.hh>
+
+#include <CallGraph.hh>
+#include <Hir.hh>
+#include <Interpreter.hh>
+#include <Merging.hh>
+#include <NativeCode.hh>
+
+#include <coel/ir/Types.hh>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+struct DispatchEntry {
+    std::size_t call_count{0};
+    NativeFunction code{nullptr};
+    std::optional<std::size_t> cache_key;
+};
+
+class TieredRunner {
+    const hir::Root &m_root;
+    const std::size_t m_threshold;
+    std::vector<TierUpRemark> &m_remarks;
+    CodeCache *const m_code_cache;
+    std::unordered_map<const hir::Function *, std::size_t> m_hashes;
+    std::unordered_map<const hir::Function *, DispatchEntry> m_dispatch_table;
+
+    std::size_t cache_key(const hir::Function &function) const;
+    // Returns nullptr if the code couldn't be mapped.
+    NativeFunction compile(const hir::Function &function, std::optional<std::size_t> cache_key);
+
+public:
+    TieredRunner(const hir::Root &root, std::size_t threshold, std::vector<TierUpRemark> &remarks,
+                 CodeCache *code_cache)
+        : m_root(root), m_threshold(threshold), m_remarks(remarks), m_code_cache(code_cache) {
+        if (code_cache != nullptr) {
+            m_hashes = hash_functions(root);
+        }
+    }
+
+    std::optional<std::uint64_t> call(const hir::Function &function, std::span<const std::uint64_t> args);
+};
+
+std::size_t TieredRunner::cache_key(const hir::Function &function) const {
+    // The function itself comes first, followed by the rest of the functions it reaches in a stable order.
+    auto functions = reachable_functions(m_root, function);
+    std::sort(functions.begin() + 1, functions.end(), [](const hir::Function *lhs, const hir::Function *rhs) {
+        return lhs->name() < rhs->name();
+    });
+    std::size_t key = functions.size();
+    for (const auto *reachable : functions) {
+        for (auto hash : {std::hash<std::string_view>{}(reachable->name()), m_hashes.at(reachable)}) {
+            key ^= hash + 0x9e3779b97f4a7c15 + (key << 6) + (key >> 2);
+        }
+    }
+    return key;
+}
+
+NativeFunction TieredRunner::compile(const hir::Function &function, std::optional<std::size_t> cache_key) {
+    auto code = compile_native(m_root, function);
+    if (!code) {
+        return nullptr;
+    }
+    m_remarks.push_back({function.name(), code->size, false});
+    if (cache_key) {
+        m_code_cache->insert(*cache_key, {reinterpret_cast<void *>(code->entry), code->size});
+    }
+    return code->entry;
+}
+
+std::optional<std::uint64_t> TieredRunner::call(const hir::Function &function, std::span<const std::uint64_t> args) {
+    auto &entry = m_dispatch_table[&function];
+    if (entry.code == nullptr) {
+        if (args.size() > k_register_arg_count) {
+            return std::nullopt;
+        }
+        if (m_code_cache != nullptr && !entry.cache_key) {
+            entry.cache_key = cache_key(function);
+            if (const auto *code = m_code_cache->find(*entry.cache_key)) {
+                entry.code = reinterpret_cast<NativeFunction>(code->entry);
+                m_remarks.push_back({function.name(), code->size, true});
+            }
+        }
+    }
+    if (entry.code == nullptr) {
+        if (++entry.call_count < m_threshold) {
+            return std::nullopt;
+        }
+        entry.code = compile(function, entry.cache_key);
+        if (entry.code == nullptr) {
+            // Keep interpreting, and only try again once the function has been called threshold more times.
+            entry.call_count = 0;
+            return std::nullopt;
+        }
+    }
+
+    std::array<std::uint64_t, k_register_arg_count> registers{};
+    std::copy(args.begin(), args.end(), registers.begin());
+    auto value = entry.code(registers[0], registers[1], registers[2], registers[3], registers[4], registers[5]);
+
+    // Only the low bits of the return register are defined for narrower return types.
+    const auto *type = m_root.type(function.block()).real()->as_non_null<coel::ir::IntegerType>();
+    return type->bit_width() < 64 ? value & ((std::uint64_t(1) << type->bit_width()) - 1) : value;
+}
+
+} // namespace
+
+std::uint64_t run_tiered(const hir::Root &root, const hir::Function &entry, std::size_t threshold,
+                         std::vector<TierUpRemark> &remarks, CodeCache *code_cache) {
+    TieredRunner runner(root, threshold, remarks, code_cache);
+    auto call_handler = [&](const hir::Function &callee, std::span<const std::uint64_t> args) {
+        return runner.call(callee, args);
+    };
+    return interpret_hir(root, entry, {}, nullptr, call_handler);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace hir {
+
+class Function;
+class Root;
+
+} // namespace hir
+
+struct TierUpRemark {
+    std::string_view function;
+    std::size_t code_size;
+    bool reused;
+};
+
+// Compiled code kept across runs of successive versions of a program. Code is keyed by the content of the function it
+// was compiled for and of every function reachable from it, so it can be reused as long as none of those change.
+class CodeCache {
+public:
+    struct Code {
+        void *entry;
+        std::size_t size;
+    };
+
+private:
+    std::unordered_map<std::size_t, Code> m_code;
+
+public:
+    const Code *find(std::size_t key) const {
+        auto it = m_code.find(key);
+        return it != m_code.end() ? &it->second : nullptr;
+    }
+    void insert(std::size_t key, const Code &code) { m_code.insert_or_assign(key, code); }
+};
+
+// Runs a function by interpreting its HIR, counting the calls made to each function. Once a function has been called
+// threshold times, it is compiled along with every function it can reach and entered into a dispatch table, so that
+// later calls to it from the interpreter run the compiled code instead. With a threshold of one, each function is
+// compiled lazily on its first call from the interpreter. Functions which take more arguments than can be passed in
+// registers are always interpreted. If a code cache is given, functions whose code is already in the cache run it from
+// their first call, and newly compiled code is added to it. The HIR must not be modified while running.
+std::uint64_t run_tiered(const hir::Root &root, const hir::Function &entry, std::size_t threshold,
+                         std::vector<TierUpRemark> &remarks, CodeCache *code_cache = nullptr);
@@ -14,6 +14,10 @@ std::string_view Token::kind_string(TokenKind kind) {
         return "':'"sv;
     case TokenKind::Comma:
         return "','"sv;
+    case TokenKind::DotDot:
+        return "'..'"sv;
+    case TokenKind::DotDotEq:
+        return "'..='"sv;
     case TokenKind::Eof:
         return "eof"sv;
     case TokenKind::Eq:
@@ -46,6 +50,8 @@ std::string_view Token::kind_string(TokenKind kind) {
         return "')'"sv;
     case TokenKind::Semi:
         return "';'"sv;
+    case TokenKind::Underscore:
+        return "'_'"sv;
     }
 }
 
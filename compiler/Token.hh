@@ -9,6 +9,8 @@ enum class TokenKind {
     Arrow,
     Colon,
     Comma,
+    DotDot,
+    DotDotEq,
     Eof,
     Eq,
     Identifier,
@@ -25,6 +27,7 @@ enum class TokenKind {
     RightBrace,
     RightParen,
     Semi,
+    Underscore,
 };
 
 class Token {
@@ -1,10 +1,23 @@
 #include <Analysis.hh>
 #include <Ast.hh>
 #include <AstLowering.hh>
+#include <Batch.hh>
+#include <CallGraph.hh>
 #include <CharStream.hh>
 #include <HirLowering.hh>
+#include <HirParser.hh>
+#include <Inlining.hh>
+#include <Interpreter.hh>
+#include <JitRegistration.hh>
 #include <Lexer.hh>
+#include <Merging.hh>
+#include <NativeCode.hh>
 #include <Parser.hh>
+#include <Profile.hh>
+#include <SharedCode.hh>
+#include <SourceLocation.hh>
+#include <Specialisation.hh>
+#include <Tiering.hh>
 #include <Token.hh>
 
 #include <coel/codegen/Context.hh>
@@ -14,24 +27,306 @@
 #include <coel/x86/Legaliser.hh>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
 #include <sys/mman.h>
+#include <thread>
+
+namespace {
+
+const hir::Function *find_function(const hir::Root &root, std::string_view name) {
+    for (const auto *function : root) {
+        if (function->name() == name) {
+            return function;
+        }
+    }
+    return nullptr;
+}
+
+// Finds where each of the named functions starts and ends within the encoded code, sorted by offset. The encoder only
+// reports the offset of the entry function, so the code is encoded again with each function as the entry to find where
+// it starts. Each function then extends up to the next.
+std::vector<JitSymbol> function_symbols(const coel::x86::Compiled &compiled, coel::ir::Unit &unit,
+                                        const std::vector<std::string> &names, std::size_t code_size) {
+    std::vector<JitSymbol> symbols;
+    for (const auto &name : names) {
+        if (auto *function = unit.find_function(name)) {
+            symbols.push_back({name, coel::x86::encode(compiled, function).first, 0});
+        }
+    }
+    std::sort(symbols.begin(), symbols.end(), [](const JitSymbol &lhs, const JitSymbol &rhs) {
+        return lhs.offset < rhs.offset;
+    });
+    for (std::size_t i = 0; i < symbols.size(); i++) {
+        const auto end = i + 1 < symbols.size() ? symbols[i + 1].offset : code_size;
+        symbols[i].size = end - symbols[i].offset;
+    }
+    return symbols;
+}
+
+// Parses, analyses and lowers one function at a time. Each function's HIR is discarded once it has been lowered, so the
+// HIR never holds more than one function body. Interprocedural optimisations need the whole program, so are skipped.
+coel::ir::Unit lower_streaming(Lexer &lexer, std::vector<std::string> &function_names) {
+    HirParser parser(lexer, false);
+    auto functions = parser.parse_signatures();
+    auto &root = parser.root();
+    for (const auto *function : functions) {
+        function_names.push_back(function->name());
+    }
+    const auto watermark = root.watermark();
+    return lower_hir(root, functions, [&](const hir::Function &function) {
+        root.truncate(watermark);
+        root.reset_block(function.block());
+        parser.parse_body(function);
+        analyse_function(root, function);
+    });
+}
+
+void print_tier_up_remarks(const std::vector<TierUpRemark> &remarks) {
+    for (const auto &remark : remarks) {
+        fmt::print("{} {} ({} bytes)\n", remark.reused ? "reused" : "compiled", remark.function, remark.code_size);
+    }
+}
+
+// Runs a function once per line of stdin, taking its arguments from the whitespace separated integers on the line, and
+// prints one result per line. The rows are read into columns and run as one batch, using u8 columns if every argument
+// and the result fit. Every value must fit in the width of its parameter.
+int run_batch(const hir::Root &root, std::string_view name) {
+    const auto *function = find_function(root, name);
+    if (function == nullptr) {
+        fmt::print("error: no function named {}\n", name);
+        return 1;
+    }
+    if (function->params().size() > k_register_arg_count) {
+        fmt::print("error: {} takes too many parameters to be run as a batch\n", name);
+        return 1;
+    }
+    auto batch_function = BatchFunction::compile(root, *function);
+    if (!batch_function) {
+        fmt::print("error: failed to map code for {}\n", name);
+        return 1;
+    }
+    const auto &param_widths = batch_function->param_widths();
+    // Columns are read as u32, so wider values can't be passed in or returned.
+    const auto too_wide = [](unsigned width) {
+        return width > 32;
+    };
+    if (too_wide(batch_function->return_width()) || std::any_of(param_widths.begin(), param_widths.end(), too_wide)) {
+        fmt::print("error: {} has parameters or a return type wider than u32\n", name);
+        return 1;
+    }
+    std::vector<std::vector<std::uint32_t>> columns(param_widths.size());
+    std::size_t row_count = 0;
+    for (std::string line; std::getline(std::cin, line);) {
+        row_count++;
+        std::istringstream values(line);
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            std::uint64_t value = 0;
+            if (!(values >> value)) {
+                fmt::print("error: row {} must have {} values\n", row_count, columns.size());
+                return 1;
+            }
+            if (value >> param_widths[i] != 0) {
+                fmt::print("error: value {} on row {} doesn't fit in a u{}\n", value, row_count, param_widths[i]);
+                return 1;
+            }
+            columns[i].push_back(static_cast<std::uint32_t>(value));
+        }
+        if (!(values >> std::ws).eof()) {
+            fmt::print("error: row {} must have {} values\n", row_count, columns.size());
+            return 1;
+        }
+    }
+
+    const bool narrow = batch_function->return_width() <= 8 &&
+                        std::all_of(param_widths.begin(), param_widths.end(), [](unsigned width) {
+                            return width <= 8;
+                        });
+    if (narrow) {
+        std::vector<std::vector<std::uint8_t>> narrow_columns;
+        std::vector<std::span<const std::uint8_t>> inputs;
+        for (const auto &column : columns) {
+            narrow_columns.emplace_back(column.begin(), column.end());
+            inputs.emplace_back(narrow_columns.back());
+        }
+        std::vector<std::uint8_t> output(row_count);
+        batch_function->run(inputs, output);
+        for (auto value : output) {
+            fmt::print("{}\n", value);
+        }
+        return 0;
+    }
+    std::vector<std::span<const std::uint32_t>> inputs(columns.begin(), columns.end());
+    std::vector<std::uint32_t> output(row_count);
+    batch_function->run(inputs, output);
+    for (auto value : output) {
+        fmt::print("{}\n", value);
+    }
+    return 0;
+}
+
+// Returns file_time_type::min() if the file doesn't exist.
+std::filesystem::file_time_type modification_time(const std::string &path) {
+    std::error_code error;
+    return std::filesystem::last_write_time(path, error);
+}
+
+// Runs the program in tiered mode every time the input file is modified. Compiled code is kept in a cache between runs,
+// so only the functions which changed, or which reach a function that changed, are compiled again.
+int watch(const std::string &input_file, bool lazy, unsigned opt_level, unsigned thread_count,
+          std::size_t tier_up_threshold, bool dump_ir) {
+    CodeCache code_cache;
+    while (true) {
+        const auto modified = modification_time(input_file);
+        auto input = CharStream::open_file(input_file.c_str());
+        if (!input) {
+            fmt::print("error: failed to open {}: {}\n", input_file, std::strerror(errno));
+            return 1;
+        }
+        auto &[file, stream] = *input;
+        Lexer lexer(std::move(stream));
+        auto root = HirParser(lexer, lazy).parse();
+        analyse_hir(root, thread_count);
+        specialise_hir(root, opt_level);
+        inline_hir(root, opt_level);
+        merge_functions(root, "main", opt_level);
+        if (const auto *main_function = find_function(root, "main")) {
+            std::vector<TierUpRemark> tier_up_remarks;
+            auto result = run_tiered(root, *main_function, tier_up_threshold, tier_up_remarks, &code_cache);
+            if (dump_ir) {
+                print_tier_up_remarks(tier_up_remarks);
+            }
+            fmt::print("main returned {}\n", result);
+        } else {
+            fmt::print("error: no main function\n");
+        }
+        std::fflush(stdout);
+
+        // Poll rather than watch the file, since editors often replace the file rather than writing to it. The file
+        // going missing, e.g. midway through being replaced, doesn't count as a change.
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const auto time = modification_time(input_file);
+            if (time != modified && time != std::filesystem::file_time_type::min()) {
+                break;
+            }
+        }
+    }
+}
+
+} // namespace
 
 int main(int argc, char **argv) {
     if (argc == 1) {
-        fmt::print("Usage: {} [-r] [-v[v]] <input-file>\n", argv[0]);
+        fmt::print("Usage: {} [-a] [-l] [-s] [-r [-c | -g] | -t[<calls>] | -w | -b<function>] [-v[v]] [-O<level>] "
+                   "[-j<threads>] [-fprofile-generate[=<file>]] [-fprofile-use[=<file>]] <input-file | ->\n",
+                   argv[0]);
         return 1;
     }
     std::string input_file;
     bool dump_codegen = false;
     bool dump_ir = false;
     bool run = false;
+    bool register_code = false;
+    bool share_code = false;
+    bool via_ast = false;
+    bool lazy = false;
+    bool streaming = false;
+    bool tiered = false;
+    bool watching = false;
+    std::size_t tier_up_threshold = 1000;
+    std::string batch_function;
+    std::string profile_generate;
+    std::string profile_use;
+    unsigned opt_level = 0;
+    unsigned thread_count = 1;
     for (int i = 1; i < argc; i++) {
         std::string_view arg(argv[i]);
+        if (arg.length() == 2 && arg == "-a") {
+            via_ast = true;
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-l") {
+            lazy = true;
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-s") {
+            streaming = true;
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-c") {
+            share_code = true;
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-w") {
+            watching = true;
+            continue;
+        }
+        if (arg.length() > 2 && arg.starts_with("-b")) {
+            batch_function = arg.substr(2);
+            continue;
+        }
+        if (arg.starts_with("-t")) {
+            tiered = true;
+            if (arg.length() == 2) {
+                continue;
+            }
+            auto [end, error] = std::from_chars(arg.data() + 2, arg.data() + arg.length(), tier_up_threshold);
+            if (error != std::errc() || end != arg.data() + arg.length() || tier_up_threshold == 0) {
+                fmt::print("error: invalid tier up threshold {}\n", arg.substr(2));
+                return 1;
+            }
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-g") {
+            register_code = true;
+            continue;
+        }
         if (arg.length() == 2 && arg == "-r") {
             run = true;
             continue;
         }
+        if (arg == "-fprofile-generate" || arg.starts_with("-fprofile-generate=")) {
+            profile_generate = arg.length() > 18 ? arg.substr(19) : "kodo.profile";
+            if (profile_generate.empty()) {
+                fmt::print("error: missing filename after -fprofile-generate=\n");
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "-fprofile-use" || arg.starts_with("-fprofile-use=")) {
+            profile_use = arg.length() > 13 ? arg.substr(14) : "kodo.profile";
+            if (profile_use.empty()) {
+                fmt::print("error: missing filename after -fprofile-use=\n");
+                return 1;
+            }
+            continue;
+        }
+        if (arg.length() == 2 && arg == "-O") {
+            opt_level = 1;
+            continue;
+        }
+        if (arg.length() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '2') {
+            opt_level = static_cast<unsigned>(arg[2] - '0');
+            continue;
+        }
+        if (arg.length() > 2 && arg.starts_with("-j")) {
+            auto [end, error] = std::from_chars(arg.data() + 2, arg.data() + arg.length(), thread_count);
+            if (error != std::errc() || end != arg.data() + arg.length() || thread_count == 0) {
+                fmt::print("error: invalid thread count {}\n", arg.substr(2));
+                return 1;
+            }
+            continue;
+        }
         if (arg.length() == 2 && arg == "-v") {
             dump_ir = true;
             continue;
@@ -41,7 +336,7 @@ int main(int argc, char **argv) {
             dump_ir = true;
             continue;
         }
-        if (arg.starts_with('-')) {
+        if (arg.starts_with('-') && arg != "-") {
             fmt::print("error: unknown option {}\n", arg.substr(1));
             return 1;
         }
@@ -57,13 +352,150 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    auto [file, stream] = CharStream::open_file(input_file.c_str());
+    if (register_code && !run) {
+        // Symbols are only registered for code which is run, and finding them means encoding the program again.
+        fmt::print("error: -g requires -r\n");
+        return 1;
+    }
+    if (!profile_generate.empty() && !run) {
+        fmt::print("error: -fprofile-generate requires -r\n");
+        return 1;
+    }
+    if (streaming && (!profile_generate.empty() || !profile_use.empty())) {
+        fmt::print("error: profiles can't be used with -s\n");
+        return 1;
+    }
+    if ((tiered || watching) && (streaming || !profile_generate.empty())) {
+        fmt::print("error: -t and -w can't be used with -s or -fprofile-generate\n");
+        return 1;
+    }
+    if (share_code && (!run || streaming || register_code)) {
+        fmt::print("error: -c requires -r and can't be used with -s or -g\n");
+        return 1;
+    }
+    if (!batch_function.empty()) {
+        if (run || tiered || watching || lazy || streaming || !profile_generate.empty()) {
+            fmt::print("error: -b can't be used with -r, -t, -w, -l, -s or -fprofile-generate\n");
+            return 1;
+        }
+        if (input_file == "-") {
+            fmt::print("error: -b needs an input file, since rows are read from stdin\n");
+            return 1;
+        }
+    }
+    if (watching) {
+        if (input_file == "-") {
+            fmt::print("error: -w needs an input file to watch\n");
+            return 1;
+        }
+        return watch(input_file, lazy, opt_level, thread_count, tier_up_threshold, dump_ir);
+    }
+    std::optional<Profile> profile;
+    if (!profile_use.empty()) {
+        profile = Profile::read(profile_use.c_str());
+        if (!profile) {
+            fmt::print("error: failed to read profile {}\n", profile_use);
+            return 1;
+        }
+    }
+
+    auto input = CharStream::open_file(input_file.c_str());
+    if (!input) {
+        fmt::print("error: failed to open {}: {}\n", input_file, std::strerror(errno));
+        return 1;
+    }
+    auto &[file, stream] = *input;
     Lexer lexer(std::move(stream));
-    Parser parser(lexer);
-    auto ast_root = parser.parse();
-    auto hir_root = lower_ast(*ast_root);
-    analyse_hir(hir_root);
-    auto unit = lower_hir(hir_root);
+    std::optional<hir::Root> hir_root;
+    std::vector<MergeRemark> merge_remarks;
+    std::vector<const hir::Function *> functions;
+    std::vector<std::string> function_names;
+    if (!streaming) {
+        // Unless asked to go via the AST, parse straight to HIR. In lazy mode, only the bodies of functions reachable
+        // from main are parsed.
+        hir_root.emplace(via_ast ? lower_ast(*Parser(lexer).parse()) : HirParser(lexer, lazy).parse());
+        analyse_hir(*hir_root, thread_count);
+        if (!profile_generate.empty()) {
+            // The IR has no memory outside of stack slots to keep counters in, so the instrumented run interprets the
+            // HIR instead of running generated code.
+            const auto *main_function = find_function(*hir_root, "main");
+            if (main_function == nullptr) {
+                fmt::print("error: no main function\n");
+                return 1;
+            }
+            Profile generated;
+            auto result = interpret_hir(*hir_root, *main_function, {}, &generated);
+            if (!generated.write(profile_generate.c_str())) {
+                fmt::print("error: failed to write profile {}: {}\n", profile_generate, std::strerror(errno));
+                return 1;
+            }
+            return static_cast<int>(result);
+        }
+        if (profile) {
+            auto reordered = reorder_match_arms(*hir_root, *profile);
+            if (dump_ir && !reordered.empty()) {
+                fmt::print("=================\n");
+                fmt::print("REORDERED MATCHES\n");
+                fmt::print("=================\n");
+                for (const auto &location : reordered) {
+                    fmt::print("{}:{}: reordered arms by frequency\n", location.line(), location.column());
+                }
+            }
+        }
+        auto specialisation_remarks = specialise_hir(*hir_root, opt_level);
+        if (dump_ir && !specialisation_remarks.empty()) {
+            fmt::print("=====================\n");
+            fmt::print("SPECIALISED FUNCTIONS\n");
+            fmt::print("=====================\n");
+            for (const auto &remark : specialisation_remarks) {
+                fmt::print("specialised {} as {} for {} call sites\n", remark.callee, remark.clone,
+                           remark.call_count);
+            }
+        }
+        auto inline_remarks = inline_hir(*hir_root, opt_level, profile ? &*profile : nullptr);
+        if (dump_ir && !inline_remarks.empty()) {
+            fmt::print("=============\n");
+            fmt::print("INLINED CALLS\n");
+            fmt::print("=============\n");
+            for (const auto &remark : inline_remarks) {
+                fmt::print("{}:{}: inlined {} into {} (cost {})\n", remark.location.line(), remark.location.column(),
+                           remark.callee, remark.caller, remark.cost);
+            }
+        }
+        merge_remarks = merge_functions(*hir_root, "main", opt_level);
+        functions = order_functions(*hir_root, "main", profile ? &*profile : nullptr);
+        for (const auto *function : functions) {
+            function_names.push_back(function->name());
+        }
+    }
+    if (tiered) {
+        const auto *main_function = find_function(*hir_root, "main");
+        if (main_function == nullptr) {
+            fmt::print("error: no main function\n");
+            return 1;
+        }
+        std::vector<TierUpRemark> tier_up_remarks;
+        auto result = run_tiered(*hir_root, *main_function, tier_up_threshold, tier_up_remarks);
+        if (dump_ir && !tier_up_remarks.empty()) {
+            fmt::print("===================\n");
+            fmt::print("TIERED UP FUNCTIONS\n");
+            fmt::print("===================\n");
+            print_tier_up_remarks(tier_up_remarks);
+        }
+        return static_cast<int>(result);
+    }
+    if (!batch_function.empty()) {
+        return run_batch(*hir_root, batch_function);
+    }
+    std::uint64_t program_hash = 0;
+    if (share_code) {
+        // Another process may have already compiled the same program, in which case there's nothing left to do.
+        program_hash = hash_program(*hir_root, functions);
+        if (auto shared = find_shared_code(program_hash)) {
+            return reinterpret_cast<int (*)()>(shared->code + shared->entry)();
+        }
+    }
+    auto unit = streaming ? lower_streaming(lexer, function_names) : lower_hir(*hir_root, functions);
     if (dump_ir) {
         fmt::print("============\n");
         fmt::print("GENERATED IR\n");
@@ -89,11 +521,41 @@ int main(int argc, char **argv) {
 
     auto compiled = coel::x86::compile(unit);
     auto [entry, encoded] = coel::x86::encode(compiled, unit.find_function("main"));
+    std::vector<JitSymbol> symbols;
+    if (register_code || (dump_ir && !merge_remarks.empty())) {
+        symbols = function_symbols(compiled, unit, function_names, encoded.size());
+    }
+    if (dump_ir && !merge_remarks.empty()) {
+        // A merged function would have been encoded identically to the function it was merged into, so the savings are
+        // the sizes of the targets. Targets which ended up unreachable don't save anything.
+        std::size_t saved = 0;
+        fmt::print("================\n");
+        fmt::print("MERGED FUNCTIONS\n");
+        fmt::print("================\n");
+        for (const auto &remark : merge_remarks) {
+            fmt::print("merged {} into {}\n", remark.function->name(), remark.target->name());
+            auto it = std::find_if(symbols.begin(), symbols.end(), [&](const JitSymbol &symbol) {
+                return symbol.name == remark.target->name();
+            });
+            if (it != symbols.end()) {
+                saved += it->size;
+            }
+        }
+        fmt::print("saved {} bytes\n", saved);
+    }
+    if (share_code) {
+        if (auto shared = publish_shared_code(program_hash, encoded, entry)) {
+            return reinterpret_cast<int (*)()>(shared->code + shared->entry)();
+        }
+    }
     if (run) {
         auto *code_region =
             // NOLINTNEXTLINE
             mmap(nullptr, encoded.size(), PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         memcpy(code_region, encoded.data(), encoded.size());
+        if (register_code) {
+            register_jit_code({static_cast<const std::uint8_t *>(code_region), encoded.size()}, symbols);
+        }
         return reinterpret_cast<int (*)()>(static_cast<std::uint8_t *>(code_region) + entry)();
     }
     std::ofstream output_file("out.bin", std::ios::binary | std::ios::trunc);